@@ -0,0 +1,425 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks of the registry core on synthetic registries.
+ *
+ * usage: registry_bench [groups...]
+ *
+ * For each size, a plugins.ini with that many groups is generated, along
+ * with a next version of it where some entries changed, were removed or
+ * were added. Each phase reports its time and the peak resident set size
+ * of the process so far, so sizes are best given in increasing order.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "registry_core.h"
+#include "registry_index.h"
+
+#define ARTIFACT_SIZE (64 * 1024)
+#define MAX_ARTIFACTS 1000
+#define CHUNK_SIZE 8192
+
+static const guint default_sizes[] = {100, 1000, 10000, 100000};
+
+static gchar *bench_dir;
+static guint compare_count;
+
+static glong peak_rss(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return -1;
+	return usage.ru_maxrss;
+}
+
+static void report(const gchar *phase, guint size, GTimer *timer, guint ops)
+{
+	gdouble secs = g_timer_elapsed(timer, NULL);
+
+	printf("%-12s %7u groups %10.2f ms %10.3f us/op %8ld KiB peak\n",
+			phase, size, secs * 1000,
+			ops ? secs * 1000000 / ops : 0.0, peak_rss());
+}
+
+static gchar *bench_path(const gchar *name)
+{
+	return g_build_filename(bench_dir, name, NULL);
+}
+
+/* write a registry of n groups. in the next version, every 10th entry
+ * has a new version, every 20th is removed and n / 20 are added. */
+static gchar *generate_registry(guint n, gboolean next, const gchar *name)
+{
+	GString *str = g_string_sized_new(n * 320);
+	GError *error = NULL;
+	gchar *file, *sum;
+	guint i, micro, total = next ? n + n / 20 : n;
+
+	for (i = 0; i < total; i++) {
+		if (next && i < n && i % 20 == 0)
+			continue;
+		micro = next && i % 10 == 0 ? 1 : 0;
+		sum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+				(const guchar *)&i, sizeof i);
+		g_string_append_printf(str,
+				"[plugin%u]\n"
+				"name=Plug-in %u\n"
+				"version=%u.%u.%u%s\n"
+				"description=Synthetic plug-in number %u, "
+				"for benchmarking the registry\n"
+				"author=Author %u <author%u@example.com>\n"
+				"url=https://example.com/plugins/%u\n"
+				"license=GPL\n"
+				"%s=https://example.com/plugins/%u.so\n"
+				"%s=%s\n\n",
+				i, i, i % 5, i % 13, micro,
+				i % 7 == 0 ? "-rc.1" : "",
+				i, i, i, i,
+				REGISTRY_INSTALL_URL_KEY, i,
+				REGISTRY_INSTALL_SHA256SUM_KEY, sum);
+		g_free(sum);
+	}
+
+	file = bench_path(name);
+	if (!g_file_set_contents(file, str->str, str->len, &error)) {
+		g_printerr("%s\n", error->message);
+		exit(1);
+	}
+	g_string_free(str, TRUE);
+
+	return file;
+}
+
+/* each parse is a generation, with an arena of its own */
+static GPtrArray *parse_or_die(const gchar *file)
+{
+	RegistryArena *arena = registry_arena_new();
+	GPtrArray *infos = registry_parse_key_file(file, arena);
+
+	registry_arena_unref(arena);
+	if (!infos) {
+		g_printerr("couldn't parse %s\n", file);
+		exit(1);
+	}
+	return infos;
+}
+
+static void free_infos(GPtrArray *infos)
+{
+	g_ptr_array_foreach(infos, (GFunc)registry_plugin_info_free, NULL);
+	g_ptr_array_free(infos, TRUE);
+}
+
+static void diff_add_cb(RegistryPluginInfo *info, guint position,
+		gpointer data)
+{
+	((guint *)data)[0]++;
+}
+
+static void diff_update_cb(RegistryPluginInfo *info, gboolean changed,
+		gpointer data)
+{
+	if (changed)
+		((guint *)data)[1]++;
+}
+
+static void diff_remove_cb(RegistryPluginInfo *info, gpointer data)
+{
+	((guint *)data)[2]++;
+}
+
+static const RegistryDiffFuncs diff_funcs = {
+	diff_add_cb,
+	diff_update_cb,
+	diff_remove_cb
+};
+
+static GHashTable *generation_from(GPtrArray *infos,
+		GHashTable *prev, guint *counts)
+{
+	GHashTable *next = registry_generation_new();
+	guint i;
+
+	for (i = 0; i < infos->len; i++)
+		registry_generation_add(next, prev,
+				g_ptr_array_index(infos, i),
+				&diff_funcs, counts);
+	registry_generation_finish(next, prev, TRUE, &diff_funcs, counts);
+	/* the generation owns the infos now */
+	g_ptr_array_free(infos, TRUE);
+
+	return next;
+}
+
+static gint compare_versions_cb(gconstpointer a, gconstpointer b)
+{
+	compare_count++;
+	return registry_version_compare(*(const RegistryVersion *)a,
+			*(const RegistryVersion *)b);
+}
+
+static void bench_parse(guint n, const gchar *ini)
+{
+	GTimer *timer = g_timer_new();
+	GPtrArray *infos;
+	RegistryArena *arena;
+	gchar *cache_file = bench_path("registry.cache");
+
+	g_timer_start(timer);
+	infos = parse_or_die(ini);
+	g_timer_stop(timer);
+	report("parse", n, timer, infos->len);
+
+	g_timer_start(timer);
+	registry_cache_save(infos, cache_file, "bench");
+	g_timer_stop(timer);
+	report("cache-write", n, timer, infos->len);
+	free_infos(infos);
+
+	g_timer_start(timer);
+	arena = registry_arena_new();
+	infos = registry_parse_cache(cache_file, "bench", arena);
+	registry_arena_unref(arena);
+	g_timer_stop(timer);
+	if (!infos) {
+		g_printerr("couldn't read %s\n", cache_file);
+		exit(1);
+	}
+	report("cache-read", n, timer, infos->len);
+	free_infos(infos);
+
+	g_unlink(cache_file);
+	g_free(cache_file);
+	g_timer_destroy(timer);
+}
+
+static void bench_diff(guint n, const gchar *ini, const gchar *next_ini)
+{
+	GTimer *timer = g_timer_new();
+	GHashTable *plugins;
+	GPtrArray *infos;
+	guint counts[3] = {0, 0, 0};
+	guint len;
+
+	plugins = generation_from(parse_or_die(ini), NULL, counts);
+	infos = parse_or_die(next_ini);
+	len = infos->len;
+	counts[0] = counts[1] = counts[2] = 0;
+
+	g_timer_start(timer);
+	plugins = generation_from(infos, plugins, counts);
+	g_timer_stop(timer);
+	report("diff", n, timer, len);
+	printf("%-12s %u added, %u changed, %u removed\n", "",
+			counts[0], counts[1], counts[2]);
+
+	g_hash_table_destroy(plugins);
+	g_timer_destroy(timer);
+}
+
+static void bench_versions(guint n, const gchar *ini)
+{
+	GTimer *timer = g_timer_new();
+	GPtrArray *infos = parse_or_die(ini);
+	RegistryVersion *versions;
+	RegistryPluginInfo *info;
+	guint i;
+
+	g_timer_start(timer);
+	for (i = 0; i < infos->len; i++) {
+		info = g_ptr_array_index(infos, i);
+		info->parsed_version = registry_version_parse(info->version);
+	}
+	g_timer_stop(timer);
+	report("version-parse", n, timer, infos->len);
+
+	versions = g_new(RegistryVersion, infos->len);
+	for (i = 0; i < infos->len; i++) {
+		info = g_ptr_array_index(infos, i);
+		versions[i] = info->parsed_version;
+	}
+
+	compare_count = 0;
+	g_timer_start(timer);
+	qsort(versions, infos->len, sizeof *versions, compare_versions_cb);
+	g_timer_stop(timer);
+	report("version-sort", n, timer, compare_count);
+
+	g_free(versions);
+	free_infos(infos);
+	g_timer_destroy(timer);
+}
+
+/* build the search index, then run queries as typed into the search box */
+static void bench_search(guint n, const gchar *ini)
+{
+	static const gchar *queries[] = {
+		"s", "sy", "syn", "synthetic", "plug-in 42", "author 7",
+		"gpl", "benchmarking registry", "no such plug-in"
+	};
+	GTimer *timer = g_timer_new();
+	GPtrArray *infos = parse_or_die(ini);
+	RegistryIndex *index;
+	guint i, hits = 0;
+
+	g_timer_start(timer);
+	index = registry_index_new();
+	for (i = 0; i < infos->len; i++)
+		registry_index_add(index, g_ptr_array_index(infos, i));
+	g_timer_stop(timer);
+	report("index", n, timer, infos->len);
+
+	g_timer_start(timer);
+	for (i = 0; i < G_N_ELEMENTS(queries); i++)
+		hits += MAX(registry_index_search(index, queries[i]), 0);
+	g_timer_stop(timer);
+	report("search", n, timer, G_N_ELEMENTS(queries));
+	printf("%-12s %u hits\n", "", hits);
+
+	registry_index_free(index);
+	free_infos(infos);
+	g_timer_destroy(timer);
+}
+
+/* hash and verify, then install and uninstall, up to MAX_ARTIFACTS
+ * plug-in files */
+static void bench_artifacts(guint n)
+{
+	GTimer *timer = g_timer_new();
+	RegistryPluginInfo **infos;
+	guchar *data;
+	gchar *plugins_dir, *file, *name;
+	GChecksum *checksum;
+	guint i, count = MIN(n, MAX_ARTIFACTS), failed = 0;
+	gsize off;
+
+	data = g_malloc(ARTIFACT_SIZE);
+	for (i = 0; i < ARTIFACT_SIZE; i++)
+		data[i] = (guchar)(i * 31 + 7);
+
+	infos = g_new0(RegistryPluginInfo *, count);
+	for (i = 0; i < count; i++) {
+		infos[i] = g_new0(RegistryPluginInfo, 1);
+		infos[i]->id = g_strdup_printf("plugin%u", i);
+		memcpy(data, &i, sizeof i);
+		infos[i]->install_sha256sum = g_compute_checksum_for_data(
+				G_CHECKSUM_SHA256, data, ARTIFACT_SIZE);
+	}
+
+	/* streamed in chunks, as while downloading */
+	g_timer_start(timer);
+	for (i = 0; i < count; i++) {
+		memcpy(data, &i, sizeof i);
+		checksum = g_checksum_new(G_CHECKSUM_SHA256);
+		for (off = 0; off < ARTIFACT_SIZE; off += CHUNK_SIZE)
+			g_checksum_update(checksum, data + off,
+					MIN(CHUNK_SIZE, ARTIFACT_SIZE - off));
+		if (registry_plugin_verify(infos[i],
+				g_checksum_get_string(checksum)) < 0)
+			failed++;
+		g_checksum_free(checksum);
+	}
+	g_timer_stop(timer);
+	report("verify", n, timer, count);
+	if (failed)
+		printf("%-12s %u failed verification\n", "", failed);
+
+	plugins_dir = bench_path("plugins");
+	g_mkdir(plugins_dir, 0700);
+	for (i = 0; i < count; i++) {
+		name = g_strdup_printf("%s.so~", infos[i]->id);
+		file = bench_path(name);
+		g_file_set_contents(file, (const gchar *)data, ARTIFACT_SIZE,
+				NULL);
+		infos[i]->tmp_download_filename = file;
+		g_free(name);
+	}
+
+	g_timer_start(timer);
+	for (i = 0; i < count; i++) {
+		if (registry_plugin_install(infos[i],
+				infos[i]->tmp_download_filename,
+				plugins_dir) < 0 ||
+		    registry_plugin_uninstall(infos[i]) < 0)
+			failed++;
+	}
+	g_timer_stop(timer);
+	report("install", n, timer, count);
+
+	for (i = 0; i < count; i++) {
+		g_unlink(infos[i]->tmp_download_filename);
+		registry_plugin_info_free(infos[i]);
+	}
+	g_rmdir(plugins_dir);
+	g_free(plugins_dir);
+	g_free(infos);
+	g_free(data);
+	g_timer_destroy(timer);
+}
+
+static void bench_size(guint n)
+{
+	gchar *ini, *next_ini;
+
+	ini = generate_registry(n, FALSE, "plugins.ini");
+	next_ini = generate_registry(n, TRUE, "plugins-next.ini");
+
+	bench_parse(n, ini);
+	bench_diff(n, ini, next_ini);
+	bench_versions(n, ini);
+	bench_search(n, ini);
+	bench_artifacts(n);
+
+	g_unlink(ini);
+	g_unlink(next_ini);
+	g_free(ini);
+	g_free(next_ini);
+}
+
+int main(int argc, char *argv[])
+{
+	GError *error = NULL;
+	gint i;
+
+	bench_dir = g_dir_make_tmp("registry-bench-XXXXXX", &error);
+	if (!bench_dir) {
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			bench_size(strtoul(argv[i], NULL, 10));
+	} else {
+		for (i = 0; i < G_N_ELEMENTS(default_sizes); i++)
+			bench_size(default_sizes[i]);
+	}
+
+	g_rmdir(bench_dir);
+	g_free(bench_dir);
+
+	return 0;
+}
@@ -19,14 +19,22 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
-#include <ctype.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "sylmain.h"
 #include "plugin.h"
 #include "defs.h"
 #include "utils.h"
-#include "spawn_curl.h"
+#include "prefs_common.h"
+#include "transfer.h"
+#include "registry_core.h"
+#include "registry_store.h"
+#include "registry_parser.h"
+#include "registry_index.h"
+#include "registry_mirror.h"
+#include "stats.h"
 
 static SylPluginInfo info = {
 	PLUGIN_NAME,
@@ -36,13 +44,16 @@ static SylPluginInfo info = {
 };
 
 #define SITE_STATIC "https://raw.githubusercontent.com/clehner/sylpheed-plugin-registry/master/"
+#define SITE_MIRROR "https://cdn.jsdelivr.net/gh/clehner/" \
+	"sylpheed-plugin-registry@master/"
 
 static struct {
-	const gchar *versions, *site, *plugins;
+	const gchar *versions, *site, *plugins, *plugins_mirror;
 } url = {
 	.site     = "https://github.com/clehner/sylpheed-plugin-registry",
 	.versions = SITE_STATIC "plugin_version.txt",
 	.plugins  = SITE_STATIC "plugins.ini",
+	.plugins_mirror = SITE_MIRROR "plugins.ini",
 };
 
 static struct {
@@ -52,19 +63,105 @@ static struct {
 	GtkWidget *update_check_btn;
 	GtkWidget *notebook;
 	GtkWidget *spinner;
+	GtkWidget *progress_bar;
+	GtkWidget *update_all_btn;
+	GtkWidget *install_selected_btn;
+	GtkWidget *search_entry;
+	GtkWidget *filter_combo;
+	GtkWidget *scrolledwin;
+	GtkWidget *stats_label;
 	GtkWidget *plugins_vbox;
-	GSList *plugin_box_list;
+	GtkWidget *tree_view;
+	GtkListStore *store;
+	GtkTreeModel *filter;
+	GtkTreeViewColumn *action_column;
+	GtkTreeViewColumn *remove_column;
+	GHashTable *plugin_boxes;
+	RegistryIndex *index;
 	gulong update_check_btn_handler_id;
+	gulong hide_handler_id;
 } pman = {0};
 
 static const guint expire_time = 12 * 60 * 60;
 
-static gchar install_url_key[32];
-static gchar install_sha1sum_key[32];
+/* background fetches start a while after startup, are checked for
+ * periodically, and are at least an hour apart */
+static const guint prefetch_delay = 60;
+static const guint prefetch_check_interval = 60 * 60;
+static const guint prefetch_min_interval = 60 * 60;
+static const guint prefetch_retry_delay = 5 * 60;
+
+/* registries with more entries than this are shown in a list view, which
+ * only renders the visible rows, instead of a box of widgets per entry */
+static const guint list_mode_threshold = 200;
+
+/* plug-in preferences, read from registryrc in the settings directory */
+static struct {
+	gchar *file;
+	gint max_downloads;
+	gboolean show_stats;
+	gboolean prefetch;
+	gint store_size;
+	gchar **mirrors;
+} prefs = {0};
+
+static struct {
+	guint timer_id;
+	guint idle_id;
+	time_t last_fetch;
+} prefetch = {0};
+
+static const gint default_max_downloads = 4;
+
+/* size in MiB of the store of downloaded plug-ins */
+static const gint default_store_size = 32;
+
+/* times a plug-in download is retried before reporting an error */
+static const guint download_retries = 3;
+
+/* how many times the size of the installed binary a patched one may be;
+ * a plug-in that grew more than that is downloaded whole */
+static const gint64 delta_max_growth = 4;
+
+/* a group of installs started together, reported with one dialog */
+static struct {
+	guint pending;
+	guint installed;
+	GString *failed;
+} batch = {0};
+
+/* installed modules by plug-in name and by file name, built on demand */
+static struct {
+	GHashTable *by_name;
+	GHashTable *by_file;
+} modules = {0};
 
 static struct {
 	gboolean loaded;
+	gboolean background;
 	gchar *tmp_file;
+	gchar *meta_file;
+	gchar *cache_file;
+	gchar *stats_file;
+	gchar *details_dir;
+	GPtrArray *fetch_mirrors;
+	guint fetch_next;
+	gint fetch_priority;
+	GSList *fetches;
+	Transfer *fetch_winner;
+	guint hedge_id;
+	GHashTable *plugins;
+	GHashTable *next_plugins;
+	GString *stream_buf;
+	gsize stream_scan;
+	RegistryParser *parser;
+	GHashTable *details;
+	GSList *details_queue;
+	GSList *details_transfers;
+	guint details_idle_id;
+	/* where the registry was fetched from, which relative detail
+	 * records are resolved against */
+	gchar *index_url;
 	enum {
 		REGISTRY_STATUS_NOT_LOADED,
 		REGISTRY_STATUS_LOADING,
@@ -75,102 +172,185 @@ static struct {
 
 enum {
 	COL_INFO,
-	COL_ACTION,
 	N_COLS
 };
 
-typedef struct _RegistryPluginInfo {
-	SylPluginInfo syl;
-	GModule *installed_module;
-	gchar *id;
-	const gchar *installed_filename;
-	gchar *license;
-	gchar *url;
-	gchar *install_sha1sum;
-	gchar *install_url;
-	gchar *tmp_download_filename;
-	gboolean user_removed;
-	gboolean in_progress;
-} RegistryPluginInfo;
+/* entries shown by the filter of the registry page */
+enum {
+	FILTER_ALL,
+	FILTER_INSTALLED,
+	FILTER_UPDATES,
+	FILTER_AVAILABLE
+};
+
+#define NONNULL(s) ((s) ? (s) : "")
 
+/* In list mode, a PluginBox is a row of pman.store and has no widgets */
 typedef struct _PluginBox {
 	RegistryPluginInfo *plugin_info;
+	GtkTreeIter iter;
+	guint doc;
 	GtkWidget *widget;
 	GtkWidget *title_link_btn;
-	GtkWidget *spinner;
+	GtkWidget *version_label;
+	GtkWidget *progress_bar;
 	GtkWidget *install_btn;
 	GtkWidget *remove_btn;
 	GtkWidget *update_btn;
 	GtkWidget *description_label;
 	GtkWidget *author_label;
 	GtkWidget *license_label;
+	guint64 received;
+	gint64 total;
+	guint64 rate;
+	guint install_id;
 } PluginBox;
 
-struct version {
-	gint major;
-	gint minor;
-	gint micro;
-	const gchar *extra;
-};
-
 static void init_done_cb(GObject *obj, gpointer data);
 static void plugin_manager_open_cb(GObject *obj, GtkWidget *window,
 		gpointer data);
 static void plugin_manager_foreach_cb(GtkWidget *widget, gpointer data);
-static void registry_fetch_cb(GPid pid, gint status, gpointer data);
-static void plugin_download_cb(GPid pid, gint status, gpointer data);
+static void registry_fetch_cb(Transfer *transfer, gpointer data);
+static void plugin_download_cb(Transfer *transfer, gpointer data);
+static void plugin_delta_cb(Transfer *transfer, gpointer data);
+static void plugin_progress_cb(Transfer *transfer, gpointer data);
+static void registry_fetch_progress_cb(Transfer *transfer, gpointer data);
+static gboolean plugin_store_install_cb(gpointer data);
 static void plugin_box_install_cb(GtkWidget *widget, gpointer data);
 static void plugin_box_update_cb(GtkWidget *widget, gpointer data);
 static void plugin_box_remove_cb(GtkWidget *widget, gpointer data);
+static void registry_update_all_cb(GtkWidget *widget, gpointer data);
+static void registry_stats_expanded_cb(GObject *obj, GParamSpec *pspec,
+		gpointer data);
+static void registry_install_selected_cb(GtkWidget *widget, gpointer data);
+static void registry_search_changed_cb(GtkWidget *widget, gpointer data);
 
+static void plugin_manager_hide_cb(GtkWidget *widget, gpointer data);
 static gint wrap_plugin_manager_window(void);
 static void unwrap_plugin_manager_window(void);
 static GtkWidget *registry_page_create(void);
+static void registry_view_create(void);
 
 static gboolean registry_file_exists(void);
 static void registry_load(void);
-static void registry_fetch(void);
+static void registry_parse_begin(gboolean fetch);
+static void registry_parse_cancel(void);
+static void registry_parsed_cb(GPtrArray *infos, gboolean ok, gpointer data);
+static guint registry_size_hint(gint64 size);
+static void registry_update_begin(guint size_hint);
+static gboolean registry_update_add(RegistryPluginInfo *info);
+static void registry_update_finish(gboolean complete);
+static void registry_stream_write(Transfer *transfer, const gchar *buf,
+		gsize len, gpointer data);
+static void registry_stream_free(void);
+static void registry_fetch(gint priority);
+static gint registry_fetch_next(void);
+static gboolean registry_hedge_cb(gpointer data);
+static void registry_fetch_win(Transfer *transfer);
+static void registry_fetch_reset(void);
+static void registry_fetch_cancel(void);
+static void registry_fetch_error(void);
+static void registry_details_request(RegistryPluginInfo *info);
+static gboolean registry_details_idle_cb(gpointer data);
+static void registry_details_cb(Transfer *transfer, gpointer data);
+static gboolean registry_details_apply(RegistryPluginInfo *info,
+		const gchar *file);
+static void registry_details_reset(void);
+static void registry_prefetch_schedule(guint delay);
+static gboolean registry_prefetch_timeout_cb(gpointer data);
+static gboolean registry_prefetch_idle_cb(gpointer data);
+static void registry_list_populate(void);
+static void registry_meta_read(gchar **etag, gchar **last_modified,
+		gchar **url);
+static void registry_meta_write(const gchar *etag,
+		const gchar *last_modified, const gchar *url);
 static void registry_update_spinner();
-static void registry_list_add_plugin(RegistryPluginInfo *);
+static void registry_progress_update(void);
+static gchar *registry_progress_text(guint64 received, gint64 total,
+		guint64 rate);
+static void registry_list_add_plugin(RegistryPluginInfo *, gint position);
+static void registry_list_update_plugin(RegistryPluginInfo *,
+		gboolean changed);
+static void registry_list_remove_plugin(RegistryPluginInfo *);
 static void registry_list_clear(void);
+static void registry_list_reindex(void);
+static void registry_search_apply(void);
+
+static void registry_prefs_load(void);
+static void registry_stats_update(void);
+static void registry_stats_dump(void);
+static void registry_batch_begin(void);
+static void registry_batch_add(PluginBox *pbox);
+static void registry_batch_done(RegistryPluginInfo *info, gboolean ok);
+static void registry_batch_end(void);
 
 static void error_dialog(const gchar *msg);
 static void notice_dialog(const gchar *msg);
 
 static GModule *get_installed_syl_plugin_module(const gchar *name);
+static GModule *get_installed_syl_plugin_module_by_file(const gchar *file);
+static void modules_invalidate(void);
 static void unload_syl_plugin(GModule *);
-static gint compare_syl_plugin_versions(SylPluginInfo *a, SylPluginInfo *b);
 
-static RegistryPluginInfo *registry_plugin_info_load(GKeyFile *key_file,
-		const gchar *name);
-static void registry_plugin_info_free(RegistryPluginInfo *info);
+static void registry_plugin_info_set_module(RegistryPluginInfo *info,
+		GModule *module);
+static void registry_plugin_info_init_state(RegistryPluginInfo *info);
 static gint registry_plugin_download_install(PluginBox *pbox);
+static gint registry_plugin_download_update(PluginBox *pbox);
+static gint registry_plugin_download_delta(PluginBox *pbox);
+static gchar *registry_plugin_tmp_file(RegistryPluginInfo *info,
+		const gchar *suffix);
+static gboolean registry_plugin_install_verified(RegistryPluginInfo *info);
+static void registry_plugin_install_done(PluginBox *pbox, gboolean ok);
+static void registry_plugin_store_installed(RegistryPluginInfo *info);
+static void registry_plugin_error(RegistryPluginInfo *info,
+		const gchar *msg);
 static gint registry_plugin_load(RegistryPluginInfo *info,
 		const gchar *file);
-static gint registry_plugin_verify(RegistryPluginInfo *info,
-		const gchar *file);
-static gint registry_plugin_install(RegistryPluginInfo *info,
-		const gchar *file);
-static gint registry_plugin_uninstall(RegistryPluginInfo *info);
 
 static PluginBox *plugin_box_new(RegistryPluginInfo *info);
+static PluginBox *plugin_box_new_row(RegistryPluginInfo *info, guint doc,
+		gint position);
+static void plugin_box_update(PluginBox *plugin_box);
 static void plugin_box_update_buttons(PluginBox *plugin_box);
+static void plugin_box_update_progress(PluginBox *plugin_box);
+static void plugin_box_watch_transfer(PluginBox *pbox, Transfer *transfer);
+static void plugin_box_get_actions(PluginBox *pbox, gboolean *can_install,
+		gboolean *can_update, gboolean *can_remove);
+static gboolean plugin_box_is_visible(PluginBox *pbox);
+static gboolean plugin_box_expose_cb(GtkWidget *widget,
+		GdkEventExpose *event, gpointer data);
 
 void plugin_load(void)
 {
 	GList *list, *cur;
 	const gchar *ver;
 	gpointer mainwin;
+	gchar *store_dir, *mirrors_file;
 
 	g_print("registry plug-in loaded!\n");
 
+	transfer_init();
+	registry_prefs_load();
+
 	registry.tmp_file = g_strconcat(get_tmp_dir(), G_DIR_SEPARATOR_S,
 			"registry.ini", NULL);
-
-	g_snprintf(install_url_key, sizeof install_url_key,
-			"%s_url", PLATFORM);
-	g_snprintf(install_sha1sum_key, sizeof install_sha1sum_key,
-			"%s_sha1sum", PLATFORM);
+	registry.meta_file = g_strconcat(registry.tmp_file, ".meta", NULL);
+	registry.cache_file = g_strconcat(get_tmp_dir(), G_DIR_SEPARATOR_S,
+			"registry.cache", NULL);
+	registry.stats_file = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			"registry-stats.json", NULL);
+	registry.details_dir = g_strconcat(get_tmp_dir(), G_DIR_SEPARATOR_S,
+			"registry-details", NULL);
+	store_dir = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			"registry-store", NULL);
+	registry_store_init(store_dir, (guint64)prefs.store_size << 20);
+	g_free(store_dir);
+	mirrors_file = g_strconcat(get_tmp_dir(), G_DIR_SEPARATOR_S,
+			"registry-mirrors", NULL);
+	registry_mirrors_init((const gchar * const *)prefs.mirrors,
+			mirrors_file);
+	g_free(mirrors_file);
 
 	g_signal_connect(syl_app_get(), "init-done",
 			G_CALLBACK(init_done_cb), NULL);
@@ -182,9 +362,35 @@ void plugin_load(void)
 
 void plugin_unload(void)
 {
+	if (prefetch.timer_id)
+		g_source_remove(prefetch.timer_id);
+	if (prefetch.idle_id)
+		g_source_remove(prefetch.idle_id);
+	registry_list_clear();
 	if (pman.window)
 		unwrap_plugin_manager_window();
+	registry_fetch_reset();
+	registry_details_reset();
+	transfer_done();
+	registry_parse_cancel();
+	registry_parser_join_all();
+	if (registry.plugins)
+		g_hash_table_destroy(registry.plugins);
+	modules_invalidate();
+	stats_dump(registry.stats_file);
+	stats_free();
+	registry_store_done();
+	registry_mirrors_done();
 	g_free(registry.tmp_file);
+	g_free(registry.meta_file);
+	g_free(registry.cache_file);
+	g_free(registry.stats_file);
+	g_free(registry.details_dir);
+	g_free(registry.index_url);
+	g_free(prefs.file);
+	g_strfreev(prefs.mirrors);
+	if (batch.failed)
+		g_string_free(batch.failed, TRUE);
 	g_print("registry plug-in unloaded!\n");
 }
 
@@ -203,6 +409,9 @@ static void init_done_cb(GObject *obj, gpointer data)
 	syl_plugin_update_check_set_check_plugin_url(url.versions);
 	syl_plugin_update_check_set_jump_plugin_url(url.site);
 
+	if (prefs.prefetch)
+		registry_prefetch_schedule(prefetch_delay);
+
 	g_print("registry: %p: app init done\n", obj);
 }
 
@@ -219,9 +428,71 @@ static void plugin_manager_open_cb(GObject *obj, GtkWidget *window,
 		if (registry_file_exists()) {
 			registry_load();
 		} else {
-			registry_fetch();
+			registry_fetch(TRANSFER_PRIORITY_HIGH);
+		}
+	} else if (registry.status == REGISTRY_STATUS_LOADING) {
+		/* report on a background fetch, now that it is seen */
+		registry.background = FALSE;
+	}
+	registry_update_spinner();
+}
+
+/* Check for a new registry after delay seconds, and then periodically */
+static void registry_prefetch_schedule(guint delay)
+{
+	if (prefetch.timer_id)
+		g_source_remove(prefetch.timer_id);
+	prefetch.timer_id = g_timeout_add_seconds(delay,
+			registry_prefetch_timeout_cb, NULL);
+}
+
+static gboolean registry_prefetch_timeout_cb(gpointer data)
+{
+	if (!prefetch.idle_id)
+		prefetch.idle_id = g_idle_add_full(G_PRIORITY_LOW,
+				registry_prefetch_idle_cb, NULL, NULL);
+
+	/* from now on, check at the regular interval */
+	prefetch.timer_id = g_timeout_add_seconds(prefetch_check_interval,
+			registry_prefetch_timeout_cb, NULL);
+	return FALSE;
+}
+
+/* Fetch or load the registry in the background, when nothing else is
+ * going on, so that the plug-in manager opens with it ready */
+static gboolean registry_prefetch_idle_cb(gpointer data)
+{
+	time_t now = time(NULL);
+
+	prefetch.idle_id = 0;
+
+	if (registry.status == REGISTRY_STATUS_LOADING)
+		return FALSE;
+
+	if (registry_file_exists()) {
+		if (!registry.loaded) {
+			debug_print("registry: loading in the background\n");
+			registry_load();
 		}
+		return FALSE;
+	}
+
+	if (!prefs_common.online_mode ||
+	    now - prefetch.last_fetch < prefetch_min_interval)
+		return FALSE;
+
+	/* leave the network to mail */
+	if (syl_plugin_inc_is_active()) {
+		debug_print("registry: receiving mail, fetching later\n");
+		registry_prefetch_schedule(prefetch_retry_delay);
+		return FALSE;
 	}
+
+	debug_print("registry: fetching in the background\n");
+	registry.background = TRUE;
+	registry_fetch(TRANSFER_PRIORITY_LOW);
+
+	return FALSE;
 }
 
 static gboolean registry_file_exists(void)
@@ -251,7 +522,7 @@ static void plugin_manager_button_foreach_cb(GtkWidget *widget,
 
 static gint plugin_manager_update_check(void)
 {
-	registry_fetch();
+	registry_fetch(TRANSFER_PRIORITY_HIGH);
 	return TRUE;
 }
 
@@ -275,6 +546,14 @@ static void wrap_plugin_manager_update_check_btn(void)
 		G_CALLBACK(plugin_manager_update_check), NULL);
 }
 
+/* A fetch for the plug-in manager is of no use once it closes. Background
+ * fetches and installs go on. */
+static void plugin_manager_hide_cb(GtkWidget *widget, gpointer data)
+{
+	if (!registry.background)
+		registry_fetch_cancel();
+}
+
 static gint wrap_plugin_manager_window(void)
 {
 	GtkWidget *label;
@@ -302,12 +581,16 @@ static gint wrap_plugin_manager_window(void)
 	label = gtk_label_new(_("Plug-in Registry"));
 	gtk_notebook_append_page(GTK_NOTEBOOK(pman.notebook),
 			registry_page_create(), label);
+	registry_list_populate();
 
 	gtk_widget_show_all(pman.notebook);
 	gtk_box_pack_start(GTK_BOX(vbox), pman.notebook, TRUE, TRUE, 0);
 
 	gtk_notebook_set_current_page(GTK_NOTEBOOK(pman.notebook), 1);
 
+	pman.hide_handler_id = g_signal_connect(G_OBJECT(pman.window), "hide",
+			G_CALLBACK(plugin_manager_hide_cb), NULL);
+
 	return 0;
 }
 
@@ -320,16 +603,78 @@ static void unwrap_plugin_manager_window(void)
 	if (pman.update_check_btn)
 		g_signal_handler_disconnect(pman.update_check_btn,
 				pman.update_check_btn_handler_id);
+	g_signal_handler_disconnect(pman.window, pman.hide_handler_id);
 
 }
 
 static GtkWidget *registry_page_create(void)
 {
+	GtkWidget *vbox;
+	GtkWidget *hbox;
 	GtkWidget *scrolledwin;
 	GtkWidget *plugins_vbox;
 	GtkWidget *spinner;
+	GtkWidget *progress_bar;
+	GtkWidget *update_all_btn;
+	GtkWidget *install_selected_btn;
+	GtkWidget *search_entry;
+	GtkWidget *filter_combo;
+
+	vbox = gtk_vbox_new(FALSE, 0);
+
+	hbox = gtk_hbox_new(FALSE, 4);
+	gtk_container_set_border_width(GTK_CONTAINER(hbox), 2);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	gtk_widget_show(hbox);
+
+	spinner = gtk_spinner_new();
+	gtk_box_pack_start(GTK_BOX(hbox), spinner, FALSE, FALSE, 4);
+
+	/* shown while downloads are running */
+	progress_bar = gtk_progress_bar_new();
+	gtk_progress_bar_set_ellipsize(GTK_PROGRESS_BAR(progress_bar),
+			PANGO_ELLIPSIZE_END);
+	gtk_widget_set_size_request(progress_bar, 240, -1);
+	gtk_box_pack_start(GTK_BOX(hbox), progress_bar, FALSE, FALSE, 0);
+	gtk_widget_set_no_show_all(progress_bar, TRUE);
+
+	search_entry = gtk_entry_new();
+	gtk_widget_set_tooltip_text(search_entry,
+			_("Search names, descriptions, authors and licenses"));
+	gtk_box_pack_start(GTK_BOX(hbox), search_entry, TRUE, TRUE, 0);
+	gtk_widget_show(search_entry);
+	g_signal_connect(G_OBJECT(search_entry), "changed",
+			G_CALLBACK(registry_search_changed_cb), NULL);
+
+	filter_combo = gtk_combo_box_new_text();
+	gtk_combo_box_append_text(GTK_COMBO_BOX(filter_combo), _("All"));
+	gtk_combo_box_append_text(GTK_COMBO_BOX(filter_combo), _("Installed"));
+	gtk_combo_box_append_text(GTK_COMBO_BOX(filter_combo),
+			_("Updates available"));
+	gtk_combo_box_append_text(GTK_COMBO_BOX(filter_combo),
+			_("Available for this platform"));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(filter_combo), FILTER_ALL);
+	gtk_box_pack_start(GTK_BOX(hbox), filter_combo, FALSE, FALSE, 0);
+	gtk_widget_show(filter_combo);
+	g_signal_connect(G_OBJECT(filter_combo), "changed",
+			G_CALLBACK(registry_search_changed_cb), NULL);
+
+	update_all_btn = gtk_button_new_with_label(_("Update all"));
+	gtk_box_pack_end(GTK_BOX(hbox), update_all_btn, FALSE, FALSE, 0);
+	gtk_widget_show(update_all_btn);
+	g_signal_connect(G_OBJECT(update_all_btn), "clicked",
+			G_CALLBACK(registry_update_all_cb), NULL);
+
+	/* shown with the list view, which has a selection */
+	install_selected_btn = gtk_button_new_with_label(_("Install selected"));
+	gtk_box_pack_end(GTK_BOX(hbox), install_selected_btn,
+			FALSE, FALSE, 0);
+	gtk_widget_set_no_show_all(install_selected_btn, TRUE);
+	g_signal_connect(G_OBJECT(install_selected_btn), "clicked",
+			G_CALLBACK(registry_install_selected_cb), NULL);
 
 	scrolledwin = gtk_scrolled_window_new(NULL, NULL);
+	gtk_box_pack_start(GTK_BOX(vbox), scrolledwin, TRUE, TRUE, 0);
 	gtk_widget_show(scrolledwin);
 	gtk_widget_set_size_request(scrolledwin, -1, -1);
 	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolledwin),
@@ -341,13 +686,233 @@ static GtkWidget *registry_page_create(void)
 	gtk_scrolled_window_add_with_viewport
 		(GTK_SCROLLED_WINDOW(scrolledwin), plugins_vbox);
 
-	spinner = gtk_spinner_new();
-	gtk_box_pack_start(GTK_BOX(plugins_vbox), spinner, FALSE, FALSE, 4);
+	if (prefs.show_stats) {
+		GtkWidget *expander;
+		GtkWidget *stats_label;
+
+		expander = gtk_expander_new(_("Statistics"));
+		gtk_box_pack_start(GTK_BOX(vbox), expander, FALSE, FALSE, 2);
+		g_signal_connect(G_OBJECT(expander), "notify::expanded",
+				G_CALLBACK(registry_stats_expanded_cb), NULL);
+
+		stats_label = gtk_label_new(NULL);
+		gtk_label_set_selectable(GTK_LABEL(stats_label), TRUE);
+		gtk_misc_set_alignment(GTK_MISC(stats_label), 0, 0);
+		gtk_container_add(GTK_CONTAINER(expander), stats_label);
+		pman.stats_label = stats_label;
+	}
 
 	pman.spinner = spinner;
+	pman.progress_bar = progress_bar;
+	pman.update_all_btn = update_all_btn;
+	pman.install_selected_btn = install_selected_btn;
+	pman.search_entry = search_entry;
+	pman.filter_combo = filter_combo;
+	pman.scrolledwin = scrolledwin;
 	pman.plugins_vbox = plugins_vbox;
+	registry_stats_update();
+
+	return vbox;
+}
+
+static void registry_view_info_data_func(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer, GtkTreeModel *model,
+		GtkTreeIter *iter, gpointer data)
+{
+	PluginBox *pbox;
+	RegistryPluginInfo *info;
+	gchar *description, *author, *markup;
+
+	gtk_tree_model_get(model, iter, COL_INFO, &pbox, -1);
+	info = pbox->plugin_info;
+	registry_details_request(info);
+
+	/* rows have a fixed height, so keep the description on one line */
+	description = g_strdup(NONNULL(info->description));
+	g_strdelimit(description, "\r\n", ' ');
+	author = g_strdup_printf(_("by %s"), NONNULL(info->author));
+
+	markup = g_markup_printf_escaped(
+			"<b>%s</b> %s\n%s\n<small>%s    %s</small>",
+			NONNULL(info->name), NONNULL(info->version),
+			description, author, NONNULL(info->license));
+	g_object_set(renderer, "markup", markup, NULL);
+
+	g_free(markup);
+	g_free(author);
+	g_free(description);
+}
+
+static void registry_view_action_data_func(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer, GtkTreeModel *model,
+		GtkTreeIter *iter, gpointer data)
+{
+	PluginBox *pbox;
+	gboolean can_install, can_update, can_remove;
+	const gchar *text;
+
+	gtk_tree_model_get(model, iter, COL_INFO, &pbox, -1);
+	plugin_box_get_actions(pbox, &can_install, &can_update, &can_remove);
+
+	if (column == pman.remove_column)
+		text = can_remove ? _("Remove") : "";
+	else
+		text = can_update ? _("Update") :
+			can_install ? _("Install") : "";
+
+	/* the progress takes the place of the action */
+	g_object_set(renderer, "text", text, "visible",
+			column == pman.remove_column ||
+			!pbox->plugin_info->in_progress, NULL);
+}
+
+static void registry_view_progress_data_func(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer, GtkTreeModel *model,
+		GtkTreeIter *iter, gpointer data)
+{
+	PluginBox *pbox;
+	gchar *text;
+	gint value = 0;
+
+	gtk_tree_model_get(model, iter, COL_INFO, &pbox, -1);
+	if (!pbox->plugin_info->in_progress) {
+		g_object_set(renderer, "visible", FALSE, NULL);
+		return;
+	}
+
+	/* the column is narrow, so show the percentage or the size */
+	if (pbox->total > 0) {
+		value = (gint)MIN(pbox->received * 100 / pbox->total, 100);
+		text = g_strdup_printf("%d%%", value);
+	} else if (pbox->received > 0) {
+		text = g_format_size(pbox->received);
+	} else {
+		text = g_strdup(_("Waiting..."));
+	}
+	g_object_set(renderer, "visible", TRUE, "value", value, "text", text,
+			NULL);
+	g_free(text);
+}
+
+/* Run the action of the clicked action cell */
+static gboolean registry_view_button_press_cb(GtkWidget *widget,
+		GdkEventButton *event, gpointer data)
+{
+	GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(widget));
+	GtkTreeViewColumn *column;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	PluginBox *pbox;
+	gboolean can_install, can_update, can_remove;
+
+	if (event->type != GDK_BUTTON_PRESS || event->button != 1)
+		return FALSE;
+
+	if (!gtk_tree_view_get_path_at_pos(GTK_TREE_VIEW(widget),
+				(gint)event->x, (gint)event->y,
+				&path, &column, NULL, NULL))
+		return FALSE;
+	gtk_tree_model_get_iter(model, &iter, path);
+	gtk_tree_path_free(path);
+	gtk_tree_model_get(model, &iter, COL_INFO, &pbox, -1);
+
+	plugin_box_get_actions(pbox, &can_install, &can_update, &can_remove);
+
+	if (column == pman.remove_column) {
+		if (can_remove)
+			plugin_box_remove_cb(widget, pbox);
+	} else if (column == pman.action_column) {
+		if (can_update)
+			plugin_box_update_cb(widget, pbox);
+		else if (can_install)
+			plugin_box_install_cb(widget, pbox);
+	}
+
+	return FALSE;
+}
+
+static gboolean registry_view_visible_func(GtkTreeModel *model,
+		GtkTreeIter *iter, gpointer data)
+{
+	PluginBox *pbox;
+
+	gtk_tree_model_get(model, iter, COL_INFO, &pbox, -1);
+	return pbox && plugin_box_is_visible(pbox);
+}
+
+/* Replace the box of plugin widgets with a list view */
+static void registry_view_create(void)
+{
+	GtkWidget *tree_view;
+	GtkTreeViewColumn *column;
+	GtkCellRenderer *renderer;
+
+	if (pman.tree_view)
+		return;
+
+	gtk_widget_destroy(GTK_BIN(pman.scrolledwin)->child);
+	pman.plugins_vbox = NULL;
 
-	return scrolledwin;
+	/* the search hides rows through a filter of the store */
+	pman.store = gtk_list_store_new(N_COLS, G_TYPE_POINTER);
+	pman.filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(pman.store),
+			NULL);
+	gtk_tree_model_filter_set_visible_func(
+			GTK_TREE_MODEL_FILTER(pman.filter),
+			registry_view_visible_func, NULL, NULL);
+	tree_view = gtk_tree_view_new_with_model(pman.filter);
+	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree_view), FALSE);
+	gtk_tree_view_set_rules_hint(GTK_TREE_VIEW(tree_view), TRUE);
+
+	renderer = gtk_cell_renderer_text_new();
+	g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+	column = gtk_tree_view_column_new();
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	gtk_tree_view_column_set_cell_data_func(column, renderer,
+			registry_view_info_data_func, NULL, NULL);
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(column, 300);
+	gtk_tree_view_column_set_expand(column, TRUE);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+	renderer = gtk_cell_renderer_text_new();
+	column = gtk_tree_view_column_new();
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	gtk_tree_view_column_set_cell_data_func(column, renderer,
+			registry_view_action_data_func, NULL, NULL);
+	renderer = gtk_cell_renderer_progress_new();
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	gtk_tree_view_column_set_cell_data_func(column, renderer,
+			registry_view_progress_data_func, NULL, NULL);
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(column, 90);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+	pman.action_column = column;
+
+	renderer = gtk_cell_renderer_text_new();
+	column = gtk_tree_view_column_new();
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	gtk_tree_view_column_set_cell_data_func(column, renderer,
+			registry_view_action_data_func, NULL, NULL);
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(column, 70);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+	pman.remove_column = column;
+
+	/* only measure and render the rows in view */
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(tree_view), TRUE);
+
+	gtk_tree_selection_set_mode(
+			gtk_tree_view_get_selection(GTK_TREE_VIEW(tree_view)),
+			GTK_SELECTION_MULTIPLE);
+	gtk_widget_show(pman.install_selected_btn);
+
+	g_signal_connect(G_OBJECT(tree_view), "button-press-event",
+			G_CALLBACK(registry_view_button_press_cb), NULL);
+
+	gtk_container_add(GTK_CONTAINER(pman.scrolledwin), tree_view);
+	gtk_widget_show(tree_view);
+	pman.tree_view = tree_view;
 }
 
 PluginBox *plugin_box_new(RegistryPluginInfo *info)
@@ -357,7 +922,7 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 	GtkWidget *hbox;
 	GtkWidget *title_link_btn;
 	GtkWidget *version_label;
-	GtkWidget *spinner;
+	GtkWidget *progress_bar;
 	GtkWidget *install_btn;
 	GtkWidget *remove_btn;
 	GtkWidget *update_btn;
@@ -380,15 +945,15 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 
 	if (info->url) {
 		title_link_btn = gtk_link_button_new_with_label(info->url,
-				info->syl.name);
+				info->name);
 	} else {
-		title_link_btn = gtk_label_new(info->syl.name);
+		title_link_btn = gtk_label_new(info->name);
 		gtk_misc_set_padding(GTK_MISC(title_link_btn), 2, 2);
 	}
 	gtk_box_pack_start(GTK_BOX(hbox), title_link_btn, FALSE, FALSE, 0);
 	gtk_widget_show(title_link_btn);
 
-	version_label = gtk_label_new(info->syl.version);
+	version_label = gtk_label_new(info->version);
 	gtk_box_pack_start(GTK_BOX(hbox), version_label, FALSE, FALSE, 0);
 	gtk_widget_show(version_label);
 
@@ -401,10 +966,13 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 	remove_btn = gtk_button_new_with_label(_("Remove"));
 	gtk_box_pack_end(GTK_BOX(hbox), remove_btn, FALSE, FALSE, 0);
 
-	spinner = gtk_spinner_new();
-	gtk_box_pack_end(GTK_BOX(hbox), spinner, FALSE, FALSE, 4);
+	progress_bar = gtk_progress_bar_new();
+	gtk_progress_bar_set_ellipsize(GTK_PROGRESS_BAR(progress_bar),
+			PANGO_ELLIPSIZE_END);
+	gtk_widget_set_size_request(progress_bar, 240, -1);
+	gtk_box_pack_end(GTK_BOX(hbox), progress_bar, FALSE, FALSE, 4);
 
-	description_label = gtk_label_new(info->syl.description);
+	description_label = gtk_label_new(info->description);
 	gtk_box_pack_start(GTK_BOX(vbox), description_label,
 			FALSE, FALSE, 0);
 	gtk_misc_set_alignment(GTK_MISC(description_label), 0, 0);
@@ -414,7 +982,7 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
 	gtk_widget_show(hbox);
 
-	g_snprintf(buf, sizeof buf, _("by %s"), info->syl.author);
+	g_snprintf(buf, sizeof buf, _("by %s"), info->author);
 	author_label = gtk_label_new(buf);
 	gtk_box_pack_start(GTK_BOX(hbox), author_label, TRUE, TRUE, 0);
 	gtk_misc_set_alignment(GTK_MISC(author_label), 0, 0);
@@ -432,11 +1000,14 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 			G_CALLBACK(plugin_box_update_cb), plugin_box);
 	g_signal_connect(G_OBJECT(install_btn), "clicked",
 			G_CALLBACK(plugin_box_install_cb), plugin_box);
+	g_signal_connect(G_OBJECT(vbox), "expose-event",
+			G_CALLBACK(plugin_box_expose_cb), plugin_box);
 
 	plugin_box->plugin_info = info;
 	plugin_box->widget = vbox;
 	plugin_box->title_link_btn = title_link_btn;
-	plugin_box->spinner = spinner;
+	plugin_box->version_label = version_label;
+	plugin_box->progress_bar = progress_bar;
 	plugin_box->remove_btn = remove_btn;
 	plugin_box->update_btn = update_btn;
 	plugin_box->install_btn = install_btn;
@@ -449,340 +1020,1435 @@ PluginBox *plugin_box_new(RegistryPluginInfo *info)
 	return plugin_box;
 }
 
+/* the details of a plugin from an index are wanted once it is in view */
+static gboolean plugin_box_expose_cb(GtkWidget *widget,
+		GdkEventExpose *event, gpointer data)
+{
+	PluginBox *pbox = data;
+
+	registry_details_request(pbox->plugin_info);
+	return FALSE;
+}
+
+static PluginBox *plugin_box_new_row(RegistryPluginInfo *info, guint doc,
+		gint position)
+{
+	PluginBox *pbox = g_new0(PluginBox, 1);
+
+	pbox->plugin_info = info;
+	pbox->doc = doc;
+	gtk_list_store_insert_with_values(pman.store, &pbox->iter, position,
+			COL_INFO, pbox, -1);
+
+	return pbox;
+}
+
+static void plugin_box_update_row(PluginBox *pbox)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(pman.store);
+	GtkTreePath *path = gtk_tree_model_get_path(model, &pbox->iter);
+
+	gtk_tree_model_row_changed(model, path, &pbox->iter);
+	gtk_tree_path_free(path);
+}
+
 static void plugin_box_destroy(PluginBox *pbox)
 {
-	gtk_widget_destroy(pbox->widget);
-	registry_plugin_info_free(pbox->plugin_info);
+	if (pbox->install_id)
+		g_source_remove(pbox->install_id);
+	if (pbox->widget)
+		gtk_widget_destroy(pbox->widget);
+	else
+		gtk_list_store_remove(pman.store, &pbox->iter);
+	g_free(pbox);
+}
+
+/* Update the widgets of a box whose plugin info has changed */
+static void plugin_box_update(PluginBox *pbox)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+	GtkWidget *title = pbox->title_link_btn;
+	gchar buf[512];
+
+	if (!pbox->widget) {
+		plugin_box_update_row(pbox);
+		return;
+	}
+
+	if (info->url && GTK_IS_LINK_BUTTON(title)) {
+		gtk_link_button_set_uri(GTK_LINK_BUTTON(title), info->url);
+		gtk_button_set_label(GTK_BUTTON(title), info->name);
+	} else if (!info->url && GTK_IS_LABEL(title)) {
+		gtk_label_set_text(GTK_LABEL(title), info->name);
+	} else {
+		GtkWidget *hbox = gtk_widget_get_parent(title);
+
+		gtk_widget_destroy(title);
+		if (info->url) {
+			title = gtk_link_button_new_with_label(info->url,
+					info->name);
+		} else {
+			title = gtk_label_new(info->name);
+			gtk_misc_set_padding(GTK_MISC(title), 2, 2);
+		}
+		gtk_box_pack_start(GTK_BOX(hbox), title, FALSE, FALSE, 0);
+		gtk_box_reorder_child(GTK_BOX(hbox), title, 0);
+		gtk_widget_show(title);
+		pbox->title_link_btn = title;
+	}
+
+	gtk_label_set_text(GTK_LABEL(pbox->version_label), info->version);
+	gtk_label_set_text(GTK_LABEL(pbox->description_label),
+			info->description);
+	g_snprintf(buf, sizeof buf, _("by %s"), info->author);
+	gtk_label_set_text(GTK_LABEL(pbox->author_label), buf);
+	gtk_label_set_text(GTK_LABEL(pbox->license_label), info->license);
+
+	plugin_box_update_buttons(pbox);
+}
+
+static void plugin_box_get_actions(PluginBox *pbox, gboolean *can_install,
+		gboolean *can_update, gboolean *can_remove)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+	gboolean installed = info->installed_module != NULL;
+
+	*can_install = info->install_url && !info->in_progress &&
+		(!installed || info->user_removed);
+	*can_remove = installed && !info->user_removed;
+	*can_update = info->install_url != NULL && *can_remove &&
+		registry_version_compare(info->parsed_version,
+				info->installed_version) > 0;
+}
+
+/* Whether a plugin matches the search and filter of the page */
+static gboolean plugin_box_is_visible(PluginBox *pbox)
+{
+	gboolean can_install, can_update, can_remove;
+
+	if (pman.index && !registry_index_matches(pman.index, pbox->doc))
+		return FALSE;
+	if (!pman.filter_combo)
+		return TRUE;
+
+	switch (gtk_combo_box_get_active(GTK_COMBO_BOX(pman.filter_combo))) {
+	case FILTER_INSTALLED:
+		plugin_box_get_actions(pbox, &can_install, &can_update,
+				&can_remove);
+		return can_remove;
+	case FILTER_UPDATES:
+		plugin_box_get_actions(pbox, &can_install, &can_update,
+				&can_remove);
+		return can_update;
+	case FILTER_AVAILABLE:
+		return pbox->plugin_info->install_url != NULL;
+	default:
+		return TRUE;
+	}
 }
 
 static void plugin_box_update_buttons(PluginBox *pbox)
 {
 	RegistryPluginInfo *info = pbox->plugin_info;
-	GtkWidget *spinner = pbox->spinner;
+	SylPluginInfo *installed_info;
+	gboolean can_install, can_update, can_remove;
 
-	SylPluginInfo *installed_info = info->installed_module ?
+	if (!pbox->widget) {
+		plugin_box_update_row(pbox);
+		return;
+	}
+
+	plugin_box_get_actions(pbox, &can_install, &can_update, &can_remove);
+	installed_info = info->installed_module ?
 		syl_plugin_get_info(info->installed_module) : NULL;
-	gboolean can_install = info->install_url && !info->in_progress &&
-		(!installed_info || info->user_removed);
-	gboolean can_remove = installed_info != NULL && !info->user_removed;
-	gboolean can_update = info->install_url != NULL && can_remove &&
-		compare_syl_plugin_versions(&info->syl, installed_info) > 0;
 
 	gtk_widget_set_visible(pbox->install_btn, can_install && !can_update);
 	gtk_widget_set_visible(pbox->update_btn, can_update);
 	gtk_widget_set_visible(pbox->remove_btn, can_remove);
+	gtk_widget_set_visible(pbox->widget, plugin_box_is_visible(pbox));
 
 	if (can_update) {
 		gchar buf[128];
 		g_snprintf(buf, sizeof buf, _("Update from %s to %s"),
-			installed_info->version, info->syl.version);
+			installed_info->version, info->version);
 		gtk_widget_set_tooltip_text(pbox->update_btn, buf);
 	}
 
-	if (pbox->plugin_info->in_progress) {
-		gtk_widget_show(pbox->spinner);
-		gtk_spinner_start(GTK_SPINNER(pbox->spinner));
-	} else {
-		gtk_widget_hide(pbox->spinner);
-		gtk_spinner_stop(GTK_SPINNER(pbox->spinner));
-	}
+	gtk_widget_set_visible(pbox->progress_bar,
+			pbox->plugin_info->in_progress);
+	if (pbox->plugin_info->in_progress)
+		plugin_box_update_progress(pbox);
 }
 
-static void registry_list_add_plugin(RegistryPluginInfo *info)
+/* Show the progress of the download of a plugin */
+static void plugin_box_update_progress(PluginBox *pbox)
 {
-	PluginBox *pbox = plugin_box_new(info);
-	pman.plugin_box_list = g_slist_prepend(pman.plugin_box_list, pbox);
-	gtk_box_pack_start(GTK_BOX(pman.plugins_vbox), pbox->widget,
-			FALSE, FALSE, 0);
+	GtkProgressBar *bar;
+	gchar *text;
+
+	if (!pbox->widget) {
+		plugin_box_update_row(pbox);
+		return;
+	}
+
+	bar = GTK_PROGRESS_BAR(pbox->progress_bar);
+	text = registry_progress_text(pbox->received, pbox->total,
+			pbox->rate);
+	gtk_progress_bar_set_text(bar, text);
+	g_free(text);
+	if (pbox->total > 0)
+		gtk_progress_bar_set_fraction(bar, MIN((gdouble)pbox->received /
+					pbox->total, 1.0));
+	else if (pbox->received > 0)
+		gtk_progress_bar_pulse(bar);
+	else
+		gtk_progress_bar_set_fraction(bar, 0);
 }
 
-static void registry_list_clear(void)
+/* Report the progress of a download of the plugin of a box, from now */
+static void plugin_box_watch_transfer(PluginBox *pbox, Transfer *transfer)
 {
-	g_slist_free_full(pman.plugin_box_list,
-			(GDestroyNotify)plugin_box_destroy);
-	pman.plugin_box_list = NULL;
+	pbox->received = 0;
+	pbox->total = -1;
+	pbox->rate = 0;
+	transfer->progress_func = plugin_progress_cb;
 }
 
-static void plugin_box_install_cb(GtkWidget *widget, gpointer data)
+static void plugin_progress_cb(Transfer *transfer, gpointer data)
 {
 	PluginBox *pbox = data;
-	RegistryPluginInfo *info = pbox->plugin_info;
-
-	registry_plugin_download_install(pbox);
 
-	plugin_box_update_buttons(pbox);
+	pbox->received = transfer->received;
+	pbox->total = transfer->total;
+	pbox->rate = transfer->rate;
+	plugin_box_update_progress(pbox);
+	registry_progress_update();
 }
 
-static gint registry_plugin_download_install(PluginBox *pbox)
+static void registry_list_add_plugin(RegistryPluginInfo *info,
+		gint position)
 {
-	RegistryPluginInfo *info = pbox->plugin_info;
-	info->in_progress = TRUE;
-	info->tmp_download_filename = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			PLUGIN_DIR, G_DIR_SEPARATOR_S,
-			info->id, ".", G_MODULE_SUFFIX, "~", NULL);
+	PluginBox *pbox;
+	gint64 start = stats_now();
+	guint doc;
 
-	/* Download the plugin to a temp file */
-	if (spawn_curl(info->install_url, plugin_download_cb,
-				info->tmp_download_filename, pbox) < 0) {
-		registry.status = REGISTRY_STATUS_ERROR;
-		error_dialog(_("Couldn't download the plug-in"));
-		return -1;
+	/* without the page, the plugins are shown when it is created */
+	if (!pman.scrolledwin)
+		return;
+
+	if (!pman.plugin_boxes) {
+		pman.plugin_boxes = g_hash_table_new_full(g_str_hash,
+				g_str_equal, g_free,
+				(GDestroyNotify)plugin_box_destroy);
+		pman.index = registry_index_new();
 	}
 
-	return 0;
+	/* indexed first, so that a new row is filtered as it is inserted */
+	doc = registry_index_add(pman.index, info);
+	if (pman.tree_view) {
+		pbox = plugin_box_new_row(info, doc, position);
+	} else {
+		pbox = plugin_box_new(info);
+		pbox->doc = doc;
+		gtk_widget_set_visible(pbox->widget,
+				plugin_box_is_visible(pbox));
+		gtk_box_pack_start(GTK_BOX(pman.plugins_vbox), pbox->widget,
+				FALSE, FALSE, 0);
+		gtk_box_reorder_child(GTK_BOX(pman.plugins_vbox),
+				pbox->widget, position);
+	}
+
+	g_hash_table_insert(pman.plugin_boxes, g_strdup(info->id), pbox);
+	stats_record(STATS_RENDER, start);
 }
 
-static void plugin_download_cb(GPid pid, gint status, gpointer data)
+/* Point the box of a plugin at its newly loaded info, and update its
+ * widgets if any field changed */
+static void registry_list_update_plugin(RegistryPluginInfo *info,
+		gboolean changed)
 {
-	PluginBox *pbox = data;
-	RegistryPluginInfo *info = pbox->plugin_info;
+	PluginBox *pbox;
 
-	/* Verify the plugin's sha1sum */
-	debug_print("verify\n");
-	if (registry_plugin_verify(info, info->tmp_download_filename) < 0) {
-		error_dialog(_("The plug-in could not be verified"));
-		goto out;
+	if (!pman.plugin_boxes)
+		return;
+	pbox = g_hash_table_lookup(pman.plugin_boxes, info->id);
+	g_return_if_fail(pbox != NULL);
+
+	pbox->plugin_info = info;
+	if (changed) {
+		gint64 start = stats_now();
+
+		registry_index_remove(pman.index, pbox->doc);
+		pbox->doc = registry_index_add(pman.index, info);
+		plugin_box_update(pbox);
+		registry_list_reindex();
+		stats_record(STATS_RENDER, start);
 	}
+}
 
-	/* Load the file from the temp directory */
-	debug_print("load\n");
-	if (registry_plugin_load(info, info->tmp_download_filename) < 0) {
-		error_dialog(_("Unable to load the plugin"));
-		goto out;
-	}
+static void registry_list_remove_plugin(RegistryPluginInfo *info)
+{
+	PluginBox *pbox;
 
-	/* Install the file to the plugins directory */
-	debug_print("install\n");
-	if (registry_plugin_install(info, info->tmp_download_filename) < 0) {
-		error_dialog(_("Plug-in was loaded but not installed."));
-		goto out;
+	if (!pman.plugin_boxes)
+		return;
+	pbox = g_hash_table_lookup(pman.plugin_boxes, info->id);
+	if (pbox) {
+		registry_index_remove(pman.index, pbox->doc);
+		g_hash_table_remove(pman.plugin_boxes, info->id);
+		registry_list_reindex();
 	}
+}
 
-	notice_dialog(_("Plug-in installed!"));
+/* Build the search index again from the shown plugins once most of its
+ * documents are dead. The same plugins match, so no row changes. */
+static void registry_list_reindex(void)
+{
+	GHashTableIter iter;
+	PluginBox *pbox;
 
-	if (info->user_removed) {
-		info->user_removed = FALSE;
-	}
+	if (!registry_index_is_sparse(pman.index))
+		return;
 
-out:
-	g_free(info->tmp_download_filename);
-	info->in_progress = FALSE;
-	plugin_box_update_buttons(pbox);
+	registry_index_free(pman.index);
+	pman.index = registry_index_new();
+	g_hash_table_iter_init(&iter, pman.plugin_boxes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&pbox))
+		pbox->doc = registry_index_add(pman.index, pbox->plugin_info);
+	if (pman.search_entry)
+		registry_index_search(pman.index,
+			gtk_entry_get_text(GTK_ENTRY(pman.search_entry)));
 }
 
-static gint registry_plugin_verify(RegistryPluginInfo *info,
-		const gchar *file)
+static gint registry_plugin_info_compare_position(gconstpointer a,
+		gconstpointer b)
 {
-	gchar *cmdline[] = {"sha1sum", (gchar *)file, NULL};
-	gchar *sum;
-	gchar *output;
-	gchar *child_stdout;
-	gint ret;
-	GError *error;
+	const RegistryPluginInfo *info_a = *(RegistryPluginInfo **)a;
+	const RegistryPluginInfo *info_b = *(RegistryPluginInfo **)b;
 
-	sum = info->install_sha1sum;
-	if (!sum) return -1;
+	return info_a->position < info_b->position ? -1 :
+		info_a->position > info_b->position ? 1 : 0;
+}
 
-	if (g_spawn_sync(NULL, cmdline, NULL,
-			G_SPAWN_STDERR_TO_DEV_NULL | G_SPAWN_SEARCH_PATH,
-			NULL, NULL, &output, NULL, &ret, &error) == FALSE) {
-		g_warning("Can't execute sha1sum %s: %s\n", file,
-				error ? error->message : NULL);
-		g_error_free(error);
-		return -1;
-	}
+/* Show the plugins loaded before the page was created. While a new
+ * generation is being built, its infos replace those of the previous one,
+ * which is freed when it is done. */
+static void registry_list_populate(void)
+{
+	GPtrArray *infos = g_ptr_array_new();
+	GHashTableIter iter;
+	RegistryPluginInfo *info;
+	guint i;
 
-	if (ret == 0) {
-		debug_print("sha1sum: %s. goal: %d", output, sum);
-		ret = strncmp(sum, output, 40);
+	if (registry.next_plugins) {
+		g_hash_table_iter_init(&iter, registry.next_plugins);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&info))
+			g_ptr_array_add(infos, info);
 	}
+	if (registry.plugins) {
+		g_hash_table_iter_init(&iter, registry.plugins);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&info))
+			if (!registry.next_plugins ||
+			    !g_hash_table_lookup(registry.next_plugins,
+				    info->id))
+				g_ptr_array_add(infos, info);
+	}
+	g_ptr_array_sort(infos, registry_plugin_info_compare_position);
 
-	g_free(output);
+	if (infos->len > list_mode_threshold)
+		registry_view_create();
+	for (i = 0; i < infos->len; i++)
+		registry_list_add_plugin(g_ptr_array_index(infos, i), i);
 
-	return ret == 0 ? 0 : -1;
+	g_ptr_array_free(infos, TRUE);
 }
 
-static gint registry_plugin_load(RegistryPluginInfo *info, const gchar *file)
+static void registry_list_clear(void)
 {
-	if (syl_plugin_load(file) < 0) {
-		return -1;
+	if (pman.plugin_boxes) {
+		g_hash_table_destroy(pman.plugin_boxes);
+		pman.plugin_boxes = NULL;
 	}
-
-	debug_print("plugin loaded from download");
-
-	/* Retrieve the loaded module */
-	info->installed_module =
-		get_installed_syl_plugin_module(info->syl.name);
-
-	if (!info->installed_module)
-		return -1;
-
-	return 0;
+	if (pman.filter) {
+		g_object_unref(pman.filter);
+		pman.filter = NULL;
+	}
+	if (pman.store) {
+		g_object_unref(pman.store);
+		pman.store = NULL;
+	}
+	registry_index_free(pman.index);
+	pman.index = NULL;
 }
 
-static gint registry_plugin_install(RegistryPluginInfo *info,
-		const gchar *file)
+/* Show the plugins matching the search and filter. Only the visibility of
+ * the boxes or rows changes. */
+static void registry_search_apply(void)
 {
-	gchar *dest;
+	GHashTableIter iter;
+	PluginBox *pbox;
+	gint64 start = stats_now();
 
-	/* Move file from temp location to modules directory */
-	dest = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			PLUGIN_DIR, G_DIR_SEPARATOR_S,
-			info->id, ".", G_MODULE_SUFFIX, NULL);
+	if (!pman.index)
+		return;
 
-	debug_print("installing plugin from %s to %s\n", file, dest);
+	registry_index_search(pman.index,
+			gtk_entry_get_text(GTK_ENTRY(pman.search_entry)));
 
-	if (g_rename(info->tmp_download_filename, dest) < 0) {
-		FILE_OP_ERROR(dest, "g_rename");
-		g_free(dest);
-		return -1;
+	if (pman.filter) {
+		gtk_tree_model_filter_refilter(
+				GTK_TREE_MODEL_FILTER(pman.filter));
+	} else {
+		g_hash_table_iter_init(&iter, pman.plugin_boxes);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&pbox))
+			gtk_widget_set_visible(pbox->widget,
+					plugin_box_is_visible(pbox));
 	}
 
-	info->installed_filename = dest;
+	stats_record(STATS_SEARCH, start);
+}
 
-	return 0;
+static void registry_search_changed_cb(GtkWidget *widget, gpointer data)
+{
+	registry_search_apply();
 }
 
-static void plugin_box_update_cb(GtkWidget *widget, gpointer data)
+static void plugin_box_install_cb(GtkWidget *widget, gpointer data)
 {
 	PluginBox *pbox = data;
 	RegistryPluginInfo *info = pbox->plugin_info;
-	GModule *module = info->installed_module;
-
-	if (module == NULL) {
-		return;
-	}
-
-	if (registry_plugin_uninstall(pbox->plugin_info) < 0) {
-		error_dialog(_("Unable to remove the current version of "
-					"the plugin."));
-		return;
-	}
 
 	registry_plugin_download_install(pbox);
 
 	plugin_box_update_buttons(pbox);
 }
 
-static void plugin_box_remove_cb(GtkWidget *widget, gpointer data)
+static gint registry_plugin_download_install(PluginBox *pbox)
 {
-	PluginBox *pbox = data;
 	RegistryPluginInfo *info = pbox->plugin_info;
-	GModule *module = info->installed_module;
-
-	if (module == NULL) {
-		return;
+	Transfer *transfer;
+	GChecksumType checksum_type;
+	const gchar *sum;
+
+	sum = registry_plugin_get_checksum(info, &checksum_type);
+	if (!sum) {
+		registry_plugin_error(info,
+				_("The plug-in could not be verified"));
+		return -1;
 	}
 
-	if (registry_plugin_uninstall(pbox->plugin_info) < 0) {
-		error_dialog(_("Unable to remove the plugin."));
-		return;
+	info->in_progress = TRUE;
+	info->tmp_download_filename = registry_plugin_tmp_file(info, "~");
+
+	/* A binary with this checksum was downloaded before. Install it
+	 * from an idle callback, like a download. */
+	if (registry_store_has(sum)) {
+		pbox->install_id = g_idle_add(plugin_store_install_cb, pbox);
+		return 0;
 	}
 
-	plugin_box_update_buttons(pbox);
+	/* Download the plugin to a temp file, decompressing and hashing it
+	 * on the way */
+	transfer = transfer_new(info->install_url, info->tmp_download_filename);
+	transfer->encoding = transfer_encoding_from_url(info->install_url);
+	transfer->checksum = g_checksum_new(checksum_type);
+	transfer->resume = TRUE;
+	transfer->max_retries = download_retries;
+	/* an update is about as large as the installed binary */
+	if (info->installed_filename)
+		transfer->expected_size =
+			get_file_size(info->installed_filename);
+	plugin_box_watch_transfer(pbox, transfer);
+	if (transfer_start(transfer, plugin_download_cb, pbox) < 0) {
+		g_free(info->tmp_download_filename);
+		info->tmp_download_filename = NULL;
+		info->in_progress = FALSE;
+		registry.status = REGISTRY_STATUS_ERROR;
+		registry_plugin_error(info, _("Couldn't download the plug-in"));
+		return -1;
+	}
 
-	/* TODO: show an undo option to put back the module */
+	return 0;
 }
 
-static gint registry_plugin_uninstall(RegistryPluginInfo *info)
+/* Get the path of a temp file for a plugin in the plugins directory */
+static gchar *registry_plugin_tmp_file(RegistryPluginInfo *info,
+		const gchar *suffix)
 {
-	const gchar *filename = info->installed_filename;
-	int ret;
+	return g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			PLUGIN_DIR, G_DIR_SEPARATOR_S,
+			info->id, ".", G_MODULE_SUFFIX, suffix, NULL);
+}
 
-	g_return_val_if_fail(filename != NULL, -1);
+static void plugin_download_cb(Transfer *transfer, gpointer data)
+{
+	PluginBox *pbox = data;
+	RegistryPluginInfo *info = pbox->plugin_info;
+	gboolean ok = FALSE;
 
-	/* Delete the module file */
-	debug_print("unlinking %s\n", filename);
-	if (g_unlink(filename) < 0) {
-		FILE_OP_ERROR(filename, "g_unlink");
-		ret = -1;
-	} else {
-		info->user_removed = TRUE;
-		ret = 0;
+	/* Verify the plugin's checksum */
+	debug_print("verify\n");
+	if (transfer->status < 0)
+		registry_plugin_error(info, _("Couldn't download the plug-in"));
+	else if (registry_plugin_verify(info,
+				g_checksum_get_string(transfer->checksum)) < 0)
+		registry_plugin_error(info,
+				_("The plug-in could not be verified"));
+	else
+		ok = registry_plugin_install_verified(info);
+
+	registry_plugin_install_done(pbox, ok);
+}
+
+static gboolean plugin_store_install_cb(gpointer data)
+{
+	PluginBox *pbox = data;
+	RegistryPluginInfo *info = pbox->plugin_info;
+	GChecksumType checksum_type;
+	const gchar *sum = registry_plugin_get_checksum(info, &checksum_type);
+
+	pbox->install_id = 0;
+	debug_print("installing %s from the store\n", info->id);
+	if (registry_store_fetch(sum, checksum_type,
+				info->tmp_download_filename) == 0) {
+		registry_plugin_install_done(pbox,
+				registry_plugin_install_verified(info));
+		return FALSE;
+	}
+
+	/* the store lost it; download it after all */
+	g_free(info->tmp_download_filename);
+	info->tmp_download_filename = NULL;
+	info->in_progress = FALSE;
+	if (registry_plugin_download_install(pbox) < 0)
+		registry_plugin_install_done(pbox, FALSE);
+	else
+		plugin_box_update_buttons(pbox);
+
+	return FALSE;
+}
+
+/* Keep the installed binary of a plugin in the store, under a checksum of
+ * the kind the registry has for it, before it is removed or replaced */
+static void registry_plugin_store_installed(RegistryPluginInfo *info)
+{
+	GChecksumType checksum_type;
+	gchar *sum;
+
+	if (!info->installed_filename ||
+	    !registry_plugin_get_checksum(info, &checksum_type))
+		return;
+
+	sum = registry_file_checksum(info->installed_filename,
+			checksum_type);
+	if (sum)
+		registry_store_add(info->installed_filename, sum);
+	g_free(sum);
+}
+
+/* Load and install a verified download, keeping a copy in the store */
+static gboolean registry_plugin_install_verified(RegistryPluginInfo *info)
+{
+	GChecksumType checksum_type;
+	gchar *plugins_dir;
+	gint64 start;
+	gint ret;
+
+	registry_store_add(info->tmp_download_filename,
+			registry_plugin_get_checksum(info, &checksum_type));
+
+	/* Load the file from the temp directory */
+	debug_print("load\n");
+	if (registry_plugin_load(info, info->tmp_download_filename) < 0) {
+		registry_plugin_error(info, _("Unable to load the plugin"));
+		return FALSE;
+	}
+
+	/* Install the file to the plugins directory */
+	debug_print("install\n");
+	plugins_dir = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			PLUGIN_DIR, NULL);
+	start = stats_now();
+	ret = registry_plugin_install(info, info->tmp_download_filename,
+			plugins_dir);
+	stats_record(STATS_INSTALL, start);
+	g_free(plugins_dir);
+	modules_invalidate();
+	if (ret < 0) {
+		registry_plugin_error(info,
+				_("Plug-in was loaded but not installed."));
+		return FALSE;
+	}
+
+	if (!info->in_batch)
+		notice_dialog(_("Plug-in installed!"));
+
+	if (info->user_removed) {
+		info->user_removed = FALSE;
+	}
+
+	return TRUE;
+}
+
+static void registry_plugin_install_done(PluginBox *pbox, gboolean ok)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+
+	g_free(info->tmp_download_filename);
+	info->tmp_download_filename = NULL;
+	info->in_progress = FALSE;
+	plugin_box_update_buttons(pbox);
+	registry_stats_dump();
+	if (info->in_batch)
+		registry_batch_done(info, ok);
+}
+
+/* Report a failed install, or add it to the batch summary */
+static void registry_plugin_error(RegistryPluginInfo *info,
+		const gchar *msg)
+{
+	if (!info->in_batch) {
+		error_dialog(msg);
+		return;
 	}
 
-	return ret;
+	g_warning("%s: %s", info->name, msg);
+	if (!batch.failed)
+		batch.failed = g_string_new(NULL);
+	if (batch.failed->len)
+		g_string_append(batch.failed, ", ");
+	g_string_append(batch.failed, info->name);
 }
 
-static RegistryPluginInfo *registry_plugin_info_load(GKeyFile *key_file,
-		const gchar *name)
+static gint registry_plugin_load(RegistryPluginInfo *info, const gchar *file)
 {
-	RegistryPluginInfo *info = g_new(RegistryPluginInfo, 1);
 	GModule *module;
+	gint64 start;
+	gint ret;
+
+	modules_invalidate();
+
+	start = stats_now();
+	ret = syl_plugin_load(file);
+	stats_record(STATS_LOAD, start);
+	if (ret < 0) {
+		return -1;
+	}
+
+	debug_print("plugin loaded from download");
+
+	/* Retrieve the loaded module */
+	module = get_installed_syl_plugin_module_by_file(file);
+	if (!module)
+		module = get_installed_syl_plugin_module(info->name);
+	registry_plugin_info_set_module(info, module);
+
+	if (!info->installed_module)
+		return -1;
+
+	return 0;
+}
+
+static void plugin_box_update_cb(GtkWidget *widget, gpointer data)
+{
+	PluginBox *pbox = data;
+
+	registry_plugin_download_update(pbox);
+
+	plugin_box_update_buttons(pbox);
+}
+
+/* Remove the installed version of a plugin and download the new one */
+static gint registry_plugin_download_update(PluginBox *pbox)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+	gint ret;
+
+	if (info->installed_module == NULL)
+		return -1;
+
+	/* Keep the current version, to go back to */
+	registry_plugin_store_installed(info);
+
+	/* Prefer patching the installed binary to downloading a new one */
+	ret = registry_plugin_download_delta(pbox);
+	if (ret <= 0)
+		return ret;
+
+	ret = registry_plugin_uninstall(info);
+	modules_invalidate();
+	if (ret < 0) {
+		registry_plugin_error(info, _("Unable to remove the current "
+					"version of the plugin."));
+		return -1;
+	}
+
+	return registry_plugin_download_install(pbox);
+}
+
+/* Download a delta patch from the installed binary of a plugin, if the
+ * registry has one. The binary is moved aside as the base of the patch,
+ * which removes it like registry_plugin_uninstall. Returns 1 if there is
+ * no patch to use, and otherwise the result of the download. */
+static gint registry_plugin_download_delta(PluginBox *pbox)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+	Transfer *transfer;
+	gchar *sum, *url, *base, *patch;
+
+	if (!info->install_deltas || !info->installed_filename)
+		return 1;
+
+	sum = registry_file_checksum(info->installed_filename,
+			G_CHECKSUM_SHA256);
+	url = registry_plugin_get_delta_url(info, sum);
+	g_free(sum);
+	if (!url)
+		return 1;
+
+	base = registry_plugin_tmp_file(info, ".base~");
+	if (g_rename(info->installed_filename, base) < 0) {
+		FILE_OP_ERROR(base, "g_rename");
+		g_free(base);
+		g_free(url);
+		return 1;
+	}
+	g_free(base);
+	info->user_removed = TRUE;
+	modules_invalidate();
+
+	debug_print("updating %s with %s\n", info->id, url);
+	info->in_progress = TRUE;
+	info->tmp_download_filename = registry_plugin_tmp_file(info, "~");
+	patch = registry_plugin_tmp_file(info, ".delta~");
+	transfer = transfer_new(url, patch);
+	transfer->encoding = transfer_encoding_from_url(url);
+	transfer->resume = TRUE;
+	transfer->max_retries = download_retries;
+	plugin_box_watch_transfer(pbox, transfer);
+	g_free(patch);
+	g_free(url);
+
+	if (transfer_start(transfer, plugin_delta_cb, pbox) == 0)
+		return 0;
+
+	/* Fall back to the whole binary */
+	g_free(info->tmp_download_filename);
+	info->tmp_download_filename = NULL;
+	info->in_progress = FALSE;
+	base = registry_plugin_tmp_file(info, ".base~");
+	g_unlink(base);
+	g_free(base);
+
+	return registry_plugin_download_install(pbox);
+}
+
+/* Patch the previous binary into the new one, and verify it like a
+ * download. If the patch doesn't work out, download the whole binary. */
+static void plugin_delta_cb(Transfer *transfer, gpointer data)
+{
+	PluginBox *pbox = data;
+	RegistryPluginInfo *info = pbox->plugin_info;
+	GChecksumType checksum_type;
+	GChecksum *checksum;
+	gchar *base;
+	gint64 start;
+	gint ret = -1;
+
+	base = registry_plugin_tmp_file(info, ".base~");
+	if (transfer->status == 0 &&
+	    registry_plugin_get_checksum(info, &checksum_type)) {
+		checksum = g_checksum_new(checksum_type);
+		start = stats_now();
+		ret = registry_plugin_patch(base, transfer->outfile,
+				info->tmp_download_filename,
+				get_file_size(base) * delta_max_growth,
+				checksum);
+		stats_record(STATS_PATCH, start);
+		if (ret == 0)
+			ret = registry_plugin_verify(info,
+					g_checksum_get_string(checksum));
+		g_checksum_free(checksum);
+	}
+	g_unlink(transfer->outfile);
+	g_unlink(base);
+	g_free(base);
+
+	if (ret == 0) {
+		registry_plugin_install_done(pbox,
+				registry_plugin_install_verified(info));
+		return;
+	}
+
+	debug_print("delta update of %s failed\n", info->id);
+	g_unlink(info->tmp_download_filename);
+	g_free(info->tmp_download_filename);
+	info->tmp_download_filename = NULL;
+	info->in_progress = FALSE;
+	if (registry_plugin_download_install(pbox) < 0)
+		registry_plugin_install_done(pbox, FALSE);
+	else
+		plugin_box_update_buttons(pbox);
+}
+
+static void registry_update_all_cb(GtkWidget *widget, gpointer data)
+{
+	GHashTableIter iter;
+	PluginBox *pbox;
+	gboolean can_install, can_update, can_remove;
+
+	if (!pman.plugin_boxes)
+		return;
+
+	registry_batch_begin();
+	g_hash_table_iter_init(&iter, pman.plugin_boxes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&pbox)) {
+		plugin_box_get_actions(pbox, &can_install, &can_update,
+				&can_remove);
+		if (can_update)
+			registry_batch_add(pbox);
+	}
+	registry_batch_end();
+}
+
+static void registry_install_selected_foreach(GtkTreeModel *model,
+		GtkTreePath *path, GtkTreeIter *iter, gpointer data)
+{
+	GSList **list = data;
+	PluginBox *pbox;
+
+	gtk_tree_model_get(model, iter, COL_INFO, &pbox, -1);
+	*list = g_slist_prepend(*list, pbox);
+}
+
+static void registry_install_selected_cb(GtkWidget *widget, gpointer data)
+{
+	GtkTreeSelection *selection;
+	GSList *list = NULL, *cur;
+
+	if (!pman.tree_view)
+		return;
+
+	/* collect the rows first, since installing updates the model */
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(pman.tree_view));
+	gtk_tree_selection_selected_foreach(selection,
+			registry_install_selected_foreach, &list);
+	list = g_slist_reverse(list);
+
+	registry_batch_begin();
+	for (cur = list; cur; cur = cur->next)
+		registry_batch_add(cur->data);
+	registry_batch_end();
+
+	g_slist_free(list);
+}
+
+/* Batches hold a reference while being filled, so that installs failing
+ * right away don't end them early */
+static void registry_batch_begin(void)
+{
+	batch.pending++;
+}
+
+/* Queue the install or update of a plugin in the current batch */
+static void registry_batch_add(PluginBox *pbox)
+{
+	RegistryPluginInfo *info = pbox->plugin_info;
+	gboolean can_install, can_update, can_remove;
+	gint ret;
+
+	plugin_box_get_actions(pbox, &can_install, &can_update, &can_remove);
+	if (info->in_batch || (!can_install && !can_update))
+		return;
+
+	info->in_batch = TRUE;
+	batch.pending++;
+
+	if (can_update)
+		ret = registry_plugin_download_update(pbox);
+	else
+		ret = registry_plugin_download_install(pbox);
+	plugin_box_update_buttons(pbox);
+
+	if (ret < 0)
+		registry_batch_done(info, FALSE);
+}
+
+static void registry_batch_done(RegistryPluginInfo *info, gboolean ok)
+{
+	info->in_batch = FALSE;
+	if (ok)
+		batch.installed++;
+	registry_batch_end();
+}
+
+/* Drop a reference to the batch, and report on it when it is complete */
+static void registry_batch_end(void)
+{
+	gchar *msg;
+
+	g_return_if_fail(batch.pending > 0);
+	if (--batch.pending > 0)
+		return;
+
+	if (batch.failed) {
+		msg = g_strdup_printf(_("Couldn't install: %s"),
+				batch.failed->str);
+		error_dialog(msg);
+		g_free(msg);
+		g_string_free(batch.failed, TRUE);
+		batch.failed = NULL;
+	} else if (batch.installed > 0) {
+		msg = g_strdup_printf(_("%u plug-ins installed!"),
+				batch.installed);
+		notice_dialog(msg);
+		g_free(msg);
+	} else {
+		notice_dialog(_("All plug-ins are up to date."));
+	}
+	batch.installed = 0;
+}
+
+static void registry_prefs_load(void)
+{
+	GKeyFile *key_file;
+	GError *error = NULL;
+
+	prefs.file = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+			"registryrc", NULL);
+	prefs.max_downloads = default_max_downloads;
+	prefs.prefetch = TRUE;
+	prefs.store_size = default_store_size;
+
+	key_file = g_key_file_new();
+	if (g_key_file_load_from_file(key_file, prefs.file, G_KEY_FILE_NONE,
+				NULL)) {
+		prefs.max_downloads = g_key_file_get_integer(key_file,
+				"registry", "max_downloads", &error);
+		if (error) {
+			g_error_free(error);
+			error = NULL;
+			prefs.max_downloads = default_max_downloads;
+		}
+		prefs.show_stats = g_key_file_get_boolean(key_file,
+				"registry", "show_stats", NULL);
+		if (g_key_file_has_key(key_file, "registry", "prefetch",
+					NULL))
+			prefs.prefetch = g_key_file_get_boolean(key_file,
+					"registry", "prefetch", NULL);
+		if (g_key_file_has_key(key_file, "registry", "store_size",
+					NULL))
+			prefs.store_size = MAX(g_key_file_get_integer(
+						key_file, "registry",
+						"store_size", NULL), 0);
+		prefs.mirrors = g_key_file_get_string_list(key_file,
+				"registry", "mirrors", NULL, NULL);
+	}
+	g_key_file_free(key_file);
+
+	if (!prefs.mirrors || !prefs.mirrors[0]) {
+		g_strfreev(prefs.mirrors);
+		prefs.mirrors = g_new0(gchar *, 3);
+		prefs.mirrors[0] = g_strdup(url.plugins);
+		prefs.mirrors[1] = g_strdup(url.plugins_mirror);
+	}
+
+	debug_print("registry: up to %d downloads at once\n",
+			prefs.max_downloads);
+	transfer_set_max_active(MAX(prefs.max_downloads, 1));
+}
+
+static void plugin_box_remove_cb(GtkWidget *widget, gpointer data)
+{
+	PluginBox *pbox = data;
+	RegistryPluginInfo *info = pbox->plugin_info;
+	GModule *module = info->installed_module;
+	gint ret;
+
+	if (module == NULL) {
+		return;
+	}
+
+	/* Keep the module in the store, so that installing it again, as
+	 * with the install button that replaces the remove button, needs no
+	 * download */
+	registry_plugin_store_installed(info);
+
+	ret = registry_plugin_uninstall(pbox->plugin_info);
+	modules_invalidate();
+	if (ret < 0) {
+		error_dialog(_("Unable to remove the plugin."));
+		return;
+	}
+
+	plugin_box_update_buttons(pbox);
+}
+
+/* Set the installed module of a plugin, and parse its version */
+static void registry_plugin_info_set_module(RegistryPluginInfo *info,
+		GModule *module)
+{
+	SylPluginInfo *installed_info = module ?
+		syl_plugin_get_info(module) : NULL;
 
-	info->syl.name = g_key_file_get_locale_string(key_file, name,
-			"name", NULL, NULL);
-	info->syl.version = g_key_file_get_string(key_file, name,
-			"version", NULL);
-	info->syl.description = g_key_file_get_locale_string(key_file,
-			name, "description", NULL, NULL);
-	info->syl.author = g_key_file_get_string(key_file, name, "author",
-			NULL);
-	info->url = g_key_file_get_string(key_file, name, "url", NULL);
-	info->install_url = g_key_file_get_string(key_file, name,
-			install_url_key, NULL);
-	info->license = g_key_file_get_string(key_file, name,
-			"license", NULL);
-	info->install_sha1sum = g_key_file_get_string(key_file, name,
-			install_sha1sum_key, NULL);
-	module = get_installed_syl_plugin_module(info->syl.name);
 	info->installed_module = module;
-	info->installed_filename = module ? g_module_name(module) : NULL;
+	info->installed_version = registry_version_parse(installed_info ?
+			installed_info->version : NULL);
+}
+
+static void registry_plugin_info_init_state(RegistryPluginInfo *info)
+{
+	GModule *module = get_installed_syl_plugin_module(info->name);
+
+	registry_plugin_info_set_module(info, module);
+	g_free(info->installed_filename);
+	info->installed_filename = module ? g_strdup(g_module_name(module)) :
+		NULL;
 	info->user_removed = FALSE;
-	info->id = g_strdup(name);
 	info->in_progress = FALSE;
 	info->tmp_download_filename = NULL;
-
-	return info;
 }
 
-static void registry_plugin_info_free(RegistryPluginInfo *info)
+/* the platform and locale that the registry cache is compiled for */
+static gchar *registry_cache_tag(void)
 {
-	g_free(info->syl.name);
-	g_free(info->syl.version);
-	g_free(info->syl.description);
-	g_free(info->syl.author);
-	g_free(info->id);
-	g_free(info->url);
-	g_free(info->install_url);
-	g_free(info->install_sha1sum);
-	g_free(info);
+	return g_strconcat(PLATFORM, " ", g_get_language_names()[0], NULL);
 }
 
-/* read the plugins registry key file from the temp file */
+/* read the plugins registry, from the compiled cache if it is current or
+ * else from the temp file, and apply it to the list as it is parsed */
 static void registry_load(void)
 {
-	GKeyFile *key_file = g_key_file_new();
-	GError *error = NULL;
-	gchar **groups, **group;
-	RegistryPluginInfo *info;
+	/* plug-ins may have been loaded or unloaded since the last time */
+	modules_invalidate();
 
-	if (!g_key_file_load_from_file(key_file, registry.tmp_file,
-			G_KEY_FILE_NONE, &error)) {
-		g_warning("g_key_file_load_from_file: %s",
-				error->message);
-		g_error_free(error);
-		registry.status = REGISTRY_STATUS_ERROR;
+	registry.status = REGISTRY_STATUS_LOADING;
+	registry_parse_begin(FALSE);
+	registry_parser_push_file(registry.parser, registry.tmp_file);
+	registry_parser_end(registry.parser);
+}
+
+/* start parsing a registry off the main thread, dropping any parse that
+ * is still going */
+static void registry_parse_begin(gboolean fetch)
+{
+	gchar *tag;
+
+	registry_parse_cancel();
+
+	tag = registry_cache_tag();
+	registry.parser = registry_parser_new(registry.cache_file,
+			registry.tmp_file, tag, registry_parsed_cb,
+			GINT_TO_POINTER(fetch));
+	g_free(tag);
+}
+
+/* drop what is left of a parse, keeping what was applied of it and the
+ * rest of the old list */
+static void registry_parse_cancel(void)
+{
+	if (!registry.parser)
+		return;
+
+	registry_parser_free(registry.parser);
+	registry.parser = NULL;
+	if (registry.next_plugins)
+		registry_update_finish(FALSE);
+}
+
+/* apply a batch of parsed plugins to the list, or finish the registry */
+static void registry_parsed_cb(GPtrArray *infos, gboolean ok, gpointer data)
+{
+	gboolean fetch = GPOINTER_TO_INT(data);
+	guint i, count;
+
+	if (infos) {
+		if (!registry.next_plugins)
+			registry_update_begin(registry_size_hint(
+					get_file_size(registry.tmp_file)));
+		for (i = 0; i < infos->len; i++) {
+			RegistryPluginInfo *info = g_ptr_array_index(infos, i);
+
+			registry_plugin_info_init_state(info);
+			registry_update_add(info);
+		}
+		g_ptr_array_free(infos, TRUE);
 		return;
 	}
 
-	groups = g_key_file_get_groups(key_file, NULL);
-	if (!groups) {
+	stats_add(STATS_PARSE,
+			registry_parser_get_parse_time(registry.parser));
+	count = registry_parser_get_count(registry.parser);
+	registry_parser_free(registry.parser);
+	registry.parser = NULL;
+
+	if (ok && count > 0) {
+		registry_update_finish(TRUE);
+	} else {
+		/* not a registry */
+		if (registry.next_plugins)
+			registry_update_finish(FALSE);
 		registry.status = REGISTRY_STATUS_ERROR;
+		if (fetch)
+			registry_fetch_error();
+	}
+
+	registry_update_spinner();
+	registry_stats_dump();
+}
+
+/* Guess the number of entries of a registry from its size in bytes. The
+ * view is chosen once, so when the size isn't known the guess is of a
+ * registry large enough for the list, which suits any. */
+static guint registry_size_hint(gint64 size)
+{
+	return size > 0 ? size / 256 : G_MAXUINT;
+}
+
+/* start a new generation of the registry */
+static void registry_update_begin(guint size_hint)
+{
+	registry.next_plugins = registry_generation_new();
+
+	/* choose the view while the list is empty */
+	if (pman.scrolledwin &&
+	    (!pman.plugin_boxes || !g_hash_table_size(pman.plugin_boxes)) &&
+	    size_hint > list_mode_threshold)
+		registry_view_create();
+}
+
+static void registry_diff_add_cb(RegistryPluginInfo *info, guint position,
+		gpointer data)
+{
+	registry_list_add_plugin(info, position);
+}
+
+static void registry_diff_update_cb(RegistryPluginInfo *info,
+		gboolean changed, gpointer data)
+{
+	registry_list_update_plugin(info, changed);
+}
+
+static void registry_diff_remove_cb(RegistryPluginInfo *info, gpointer data)
+{
+	registry_list_remove_plugin(info);
+}
+
+static const RegistryDiffFuncs registry_diff_funcs = {
+	registry_diff_add_cb,
+	registry_diff_update_cb,
+	registry_diff_remove_cb
+};
+
+/* add or change a plugin in the list. takes the info. */
+static gboolean registry_update_add(RegistryPluginInfo *info)
+{
+	return registry_generation_add(registry.next_plugins,
+			registry.plugins, info, &registry_diff_funcs, NULL);
+}
+
+/* replace the previous generation. if the new one is incomplete, keep the
+ * plugins missing from it. */
+static void registry_update_finish(gboolean complete)
+{
+	registry_generation_finish(registry.next_plugins, registry.plugins,
+			complete, &registry_diff_funcs, NULL);
+	registry.plugins = registry.next_plugins;
+	registry.next_plugins = NULL;
+
+	if (complete) {
+		registry.status = REGISTRY_STATUS_LOADED;
+		registry.loaded = TRUE;
+		/* ask again for the details of the new entries */
+		registry_details_reset();
+	}
+}
+
+/* Path of the cached detail record of a plugin. The id is hashed, as it
+ * may not be a safe file name. */
+static gchar *registry_details_file(const gchar *id)
+{
+	gchar *sum, *file;
+
+	sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, id, -1);
+	file = g_strconcat(registry.details_dir, G_DIR_SEPARATOR_S, sum,
+			".ini", NULL);
+	g_free(sum);
+
+	return file;
+}
+
+/* Ask for the details of a plugin from an index, as it comes into view.
+ * They are loaded from an idle callback, as this is called while drawing,
+ * and only once per generation of the registry. */
+static void registry_details_request(RegistryPluginInfo *info)
+{
+	gchar *id;
+
+	if (!info->details_url || info->in_progress || registry.next_plugins)
+		return;
+
+	if (!registry.details)
+		registry.details = g_hash_table_new_full(g_str_hash,
+				g_str_equal, g_free, NULL);
+	else if (g_hash_table_lookup(registry.details, info->id))
+		return;
+
+	id = g_strdup(info->id);
+	g_hash_table_insert(registry.details, id, id);
+	registry.details_queue = g_slist_prepend(registry.details_queue, id);
+	if (!registry.details_idle_id)
+		registry.details_idle_id = g_idle_add(registry_details_idle_cb,
+				NULL);
+}
+
+/* Load the requested details from their cache, or else download them from
+ * the mirror that the index is best fetched from */
+static gboolean registry_details_idle_cb(gpointer data)
+{
+	RegistryPluginInfo *info;
+	RegistryMirror *mirror;
+	GPtrArray *mirrors;
+	Transfer *transfer;
+	GSList *queue, *cur;
+	gchar *file, *url;
+	const gchar *base;
+
+	registry.details_idle_id = 0;
+	queue = g_slist_reverse(registry.details_queue);
+	registry.details_queue = NULL;
+
+	/* the records are of the index that was fetched, which the best
+	 * mirror now may not have yet */
+	if (!registry.index_url)
+		registry_meta_read(NULL, NULL, &registry.index_url);
+	mirrors = registry_mirrors_order();
+	mirror = mirrors->len ? g_ptr_array_index(mirrors, 0) : NULL;
+	base = registry.index_url ? registry.index_url :
+		mirror ? mirror->url : NULL;
+	for (cur = queue; cur; cur = cur->next) {
+		info = registry.plugins ?
+			g_hash_table_lookup(registry.plugins, cur->data) : NULL;
+		if (!info || !info->details_url)
+			continue;
+
+		file = registry_details_file(info->id);
+		if (registry_details_apply(info, file)) {
+			g_free(file);
+			continue;
+		}
+
+		if (g_mkdir_with_parents(registry.details_dir, 0700) < 0) {
+			FILE_OP_ERROR(registry.details_dir,
+					"g_mkdir_with_parents");
+			g_free(file);
+			break;
+		}
+		url = registry_plugin_get_details_url(info, base);
+		debug_print("registry: fetching details from %s\n", url);
+		transfer = transfer_new(url, file);
+		g_free(url);
+		g_free(file);
+		if (transfer_start(transfer, registry_details_cb,
+					cur->data) == 0)
+			registry.details_transfers = g_slist_prepend(
+					registry.details_transfers, transfer);
+	}
+	g_ptr_array_free(mirrors, TRUE);
+	g_slist_free(queue);
+
+	return FALSE;
+}
+
+/* A plugin whose details failed to download keeps its entry from the
+ * index until the registry is loaded again */
+static void registry_details_cb(Transfer *transfer, gpointer data)
+{
+	RegistryPluginInfo *info;
+	const gchar *id = data;
+
+	registry.details_transfers = g_slist_remove(
+			registry.details_transfers, transfer);
+	if (transfer->status < 0) {
+		debug_print("registry: couldn't get the details of %s\n", id);
 		return;
 	}
 
-	registry_list_clear();
-	for (group = groups; *group; group++) {
-		info = registry_plugin_info_load(key_file, *group);
-		registry_list_add_plugin(info);
+	info = registry.plugins ? g_hash_table_lookup(registry.plugins, id) :
+		NULL;
+	if (info && info->details_url &&
+	    !registry_details_apply(info, transfer->outfile) &&
+	    info->in_progress)
+		/* ask again once it is done */
+		g_hash_table_remove(registry.details, id);
+}
+
+/* Replace the entry of a plugin from an index with its details, if the
+ * file has them for its version */
+static gboolean registry_details_apply(RegistryPluginInfo *info,
+		const gchar *file)
+{
+	RegistryPluginInfo *details;
+
+	if (info->in_progress || registry.next_plugins)
+		return FALSE;
+	details = registry_plugin_info_new_from_details(file, info);
+	if (!details)
+		return FALSE;
+
+	registry_plugin_info_init_state(details);
+	registry_plugin_info_adopt(details, info);
+	details->position = info->position;
+	g_hash_table_replace(registry.plugins, details->id, details);
+	registry_list_update_plugin(details, TRUE);
+
+	return TRUE;
+}
+
+/* Forget which details were asked for, cancelling their downloads */
+static void registry_details_reset(void)
+{
+	GSList *cur;
+
+	for (cur = registry.details_transfers; cur; cur = cur->next)
+		transfer_cancel(cur->data);
+	g_slist_free(registry.details_transfers);
+	registry.details_transfers = NULL;
+	if (registry.details_idle_id) {
+		g_source_remove(registry.details_idle_id);
+		registry.details_idle_id = 0;
+	}
+	g_slist_free(registry.details_queue);
+	registry.details_queue = NULL;
+	if (registry.details) {
+		g_hash_table_destroy(registry.details);
+		registry.details = NULL;
+	}
+}
+
+/* parse the registry as it downloads, a batch of sections at a time */
+static void registry_stream_write(Transfer *transfer, const gchar *buf,
+		gsize len, gpointer data)
+{
+	GString *str = registry.stream_buf;
+	gsize i;
+
+	/* data from a fetch that has since been dropped */
+	if (len == 0 || !str)
+		return;
+	if (!registry.fetch_winner)
+		registry_fetch_win(transfer);
+	g_string_append_len(str, buf, len);
+
+	/* the buffer is complete up to the last section header */
+	for (i = str->len - 1; i >= registry.stream_scan && i > 0; i--) {
+		if (str->str[i] == '[' && str->str[i - 1] == '\n')
+			break;
+	}
+	if (i >= registry.stream_scan && i > 0) {
+		/* guess the number of entries for the view, preferring the
+		 * size of the last copy, which isn't compressed */
+		if (!registry.next_plugins && !registry.plugins)
+			registry_update_begin(registry_size_hint(
+					transfer->expected_size > 0 ?
+					transfer->expected_size :
+					transfer->content_length));
+		registry_parser_push_data(registry.parser, str->str, i);
+		g_string_erase(str, 0, i);
+		registry.stream_scan = 1;
+	} else {
+		registry.stream_scan = str->len;
+	}
+}
+
+static void registry_stream_free(void)
+{
+	if (registry.stream_buf) {
+		g_string_free(registry.stream_buf, TRUE);
+		registry.stream_buf = NULL;
 	}
-	g_strfreev(groups);
-	registry.status = REGISTRY_STATUS_LOADED;
+}
+
+static void registry_fetch_progress_cb(Transfer *transfer, gpointer data)
+{
+	registry_progress_update();
+}
+
+/* Describe the progress of downloads, like "1.2 MB of 3.4 MB (200.0 kB/s,
+ * 0:10 left)". A rate of 0 after the start means that nothing is
+ * arriving. */
+static gchar *registry_progress_text(guint64 received, gint64 total,
+		guint64 rate)
+{
+	gchar *done, *size, *speed, *text;
+	guint64 left;
+
+	if (received == 0)
+		return g_strdup(_("Waiting..."));
+
+	done = g_format_size(received);
+	if (total >= 0 && (guint64)total >= received) {
+		gchar *all = g_format_size(total);
+
+		size = g_strdup_printf(_("%s of %s"), done, all);
+		g_free(all);
+	} else {
+		size = g_strdup(done);
+	}
+
+	if (rate == 0) {
+		text = g_strdup_printf(_("%s (stalled)"), size);
+	} else {
+		speed = g_format_size(rate);
+		if (total >= 0 && (guint64)total > received) {
+			left = (total - received) / rate;
+			text = g_strdup_printf(_("%s (%s/s, %u:%02u left)"),
+					size, speed, (guint)(left / 60),
+					(guint)(left % 60));
+		} else {
+			text = g_strdup_printf(_("%s (%s/s)"), size, speed);
+		}
+		g_free(speed);
+	}
+
+	g_free(size);
+	g_free(done);
+
+	return text;
+}
+
+/* Show the sum of the running downloads on the page */
+static void registry_progress_update(void)
+{
+	GtkProgressBar *bar;
+	guint64 received, rate;
+	gint64 total;
+	gchar *text;
+
+	if (!pman.progress_bar)
+		return;
+
+	if (transfer_get_progress(&received, &total, &rate) == 0) {
+		gtk_widget_hide(pman.progress_bar);
+		return;
+	}
+
+	bar = GTK_PROGRESS_BAR(pman.progress_bar);
+	text = registry_progress_text(received, total, rate);
+	gtk_progress_bar_set_text(bar, text);
+	g_free(text);
+	if (total > 0)
+		gtk_progress_bar_set_fraction(bar, MIN((gdouble)received /
+					total, 1.0));
+	else if (received > 0)
+		gtk_progress_bar_pulse(bar);
+	gtk_widget_show(pman.progress_bar);
 }
 
 static void registry_update_spinner()
 {
+	if (!pman.spinner)
+		return;
 	if (registry.status == REGISTRY_STATUS_LOADING) {
 		gtk_widget_show(pman.spinner);
 		gtk_spinner_start(GTK_SPINNER(pman.spinner));
@@ -792,17 +2458,238 @@ static void registry_update_spinner()
 	}
 }
 
-static void registry_fetch(void)
+/* read the validators of the cached registry file from its sidecar */
+/* Read what is known of the registry file; any of the fields may be
+ * NULL */
+static void registry_meta_read(gchar **etag, gchar **last_modified,
+		gchar **url)
 {
+	GKeyFile *key_file = g_key_file_new();
+
+	if (g_key_file_load_from_file(key_file, registry.meta_file,
+				G_KEY_FILE_NONE, NULL)) {
+		if (etag)
+			*etag = g_key_file_get_string(key_file, "cache",
+					"etag", NULL);
+		if (last_modified)
+			*last_modified = g_key_file_get_string(key_file,
+					"cache", "last_modified", NULL);
+		if (url)
+			*url = g_key_file_get_string(key_file, "cache",
+					"url", NULL);
+	}
+	g_key_file_free(key_file);
+}
+
+static void registry_meta_write(const gchar *etag,
+		const gchar *last_modified, const gchar *url)
+{
+	GKeyFile *key_file = g_key_file_new();
+	GError *error = NULL;
+	gchar *data;
+	gsize len;
+
+	if (etag)
+		g_key_file_set_string(key_file, "cache", "etag", etag);
+	if (last_modified)
+		g_key_file_set_string(key_file, "cache", "last_modified",
+				last_modified);
+	if (url)
+		g_key_file_set_string(key_file, "cache", "url", url);
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+	if (!g_file_set_contents(registry.meta_file, data, len, &error)) {
+		g_warning("g_file_set_contents: %s", error->message);
+		g_error_free(error);
+	}
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
+static void registry_fetch(gint priority)
+{
+	RegistryMirror *mirror;
+	GSList *cur;
+
+	if (priority >= TRANSFER_PRIORITY_DEFAULT)
+		registry.background = FALSE;
+	if (registry.fetches || (registry.status == REGISTRY_STATUS_LOADING &&
+				registry.background)) {
+		/* share the fetch that is running, and its result, at the
+		 * higher of the two priorities */
+		debug_print("registry: already fetching\n");
+		if (priority > registry.fetch_priority) {
+			registry.fetch_priority = priority;
+			for (cur = registry.fetches; cur; cur = cur->next)
+				transfer_set_priority(cur->data, priority);
+		}
+		registry_update_spinner();
+		return;
+	}
+
 	registry.status = REGISTRY_STATUS_LOADING;
+	prefetch.last_fetch = time(NULL);
+	modules_invalidate();
+
+	/* show the entries as they arrive */
+	registry_stream_free();
+	registry.stream_buf = g_string_new(NULL);
+	registry.stream_scan = 0;
+	registry_parse_begin(TRUE);
+
+	registry_fetch_reset();
+	registry.fetch_mirrors = registry_mirrors_order();
+	registry.fetch_priority = priority;
+	if (registry_fetch_next() < 0) {
+		registry_fetch_reset();
+		registry_stream_free();
+		registry_parse_cancel();
+		registry_fetch_error();
+	} else {
+		/* if the best mirror is slow to respond, ask the next one
+		 * too */
+		mirror = g_ptr_array_index(registry.fetch_mirrors, 0);
+		registry.hedge_id = g_timeout_add(
+				registry_mirror_hedge_delay(mirror),
+				registry_hedge_cb, NULL);
+	}
+	registry_update_spinner();
+}
+
+/* Request the registry from the next mirror that can be asked, if it has
+ * changed since the cached copy. Requests after the first write to their
+ * own file, as two may be running at once. */
+static gint registry_fetch_next(void)
+{
+	RegistryMirror *mirror;
+	Transfer *transfer;
+	gchar *outfile;
+
+	while (registry.fetch_next < registry.fetch_mirrors->len) {
+		mirror = g_ptr_array_index(registry.fetch_mirrors,
+				registry.fetch_next);
+		outfile = registry.fetch_next == 0 ?
+			g_strdup(registry.tmp_file) :
+			g_strdup_printf("%s.%u", registry.tmp_file,
+					registry.fetch_next);
+		registry.fetch_next++;
+
+		transfer = transfer_new(mirror->url, outfile);
+		g_free(outfile);
+		transfer->priority = registry.fetch_priority;
+		if (is_file_exist(registry.tmp_file)) {
+			registry_meta_read(&transfer->if_none_match,
+					&transfer->if_modified_since, NULL);
+			/* the new list is about as large as the last one */
+			transfer->expected_size =
+				get_file_size(registry.tmp_file);
+		}
+		transfer->write_func = registry_stream_write;
+		transfer->progress_func = registry_fetch_progress_cb;
+
+		debug_print("registry: fetching from %s\n", mirror->url);
+		if (transfer_start(transfer, registry_fetch_cb, mirror) == 0) {
+			registry.fetches = g_slist_prepend(registry.fetches,
+					transfer);
+			return 0;
+		}
+		registry_mirror_fail(mirror);
+	}
+
+	return -1;
+}
 
-	/* download the plugins registry key file */
-	if (spawn_curl(url.plugins, registry_fetch_cb, registry.tmp_file,
-				NULL) < 0) {
+static gboolean registry_hedge_cb(gpointer data)
+{
+	registry.hedge_id = 0;
+	if (!registry.fetch_winner && g_slist_length(registry.fetches) == 1)
+		registry_fetch_next();
+	return FALSE;
+}
+
+/* The first request to respond is used, and the others are cancelled. A
+ * cancelled mirror took at least as long as it has so far. */
+static void registry_fetch_win(Transfer *transfer)
+{
+	Transfer *other;
+	GSList *cur;
+	gint64 now = stats_now();
+
+	debug_print("registry: using %s\n", transfer->url);
+	registry.fetch_winner = transfer;
+	if (registry.hedge_id) {
+		g_source_remove(registry.hedge_id);
+		registry.hedge_id = 0;
+	}
+
+	for (cur = registry.fetches; cur; cur = cur->next) {
+		other = cur->data;
+		if (other == transfer)
+			continue;
+		/* one still queued hasn't been measured */
+		if (other->start_time)
+			registry_mirror_record(other->data,
+					now - other->start_time);
+		transfer_cancel(other);
+	}
+	g_slist_free(registry.fetches);
+	registry.fetches = g_slist_prepend(NULL, transfer);
+
+	registry_mirror_record(transfer->data, now - transfer->start_time);
+}
+
+/* Forget a fetch, cancelling any of its requests still running */
+static void registry_fetch_reset(void)
+{
+	GSList *cur;
+
+	for (cur = registry.fetches; cur; cur = cur->next)
+		transfer_cancel(cur->data);
+	if (registry.hedge_id) {
+		g_source_remove(registry.hedge_id);
+		registry.hedge_id = 0;
+	}
+	if (registry.fetch_mirrors) {
+		g_ptr_array_free(registry.fetch_mirrors, TRUE);
+		registry.fetch_mirrors = NULL;
+	}
+	g_slist_free(registry.fetches);
+	registry.fetches = NULL;
+	registry.fetch_winner = NULL;
+	registry.fetch_next = 0;
+}
+
+/* Stop a fetch that is no longer wanted, keeping what was applied of it
+ * and the rest of the old list */
+static void registry_fetch_cancel(void)
+{
+	if (!registry.fetches)
+		return;
+
+	debug_print("registry: cancelling the fetch\n");
+	registry_fetch_reset();
+	registry_stream_free();
+	registry_parse_cancel();
+	registry.status = registry.loaded ? REGISTRY_STATUS_LOADED :
+		REGISTRY_STATUS_NOT_LOADED;
+	registry_update_spinner();
+	registry_progress_update();
+}
+
+/* Report a failed fetch. Background fetches fail quietly, and leave the
+ * registry to be fetched again when the plug-in manager opens. */
+static void registry_fetch_error(void)
+{
+	if (!registry.background) {
 		registry.status = REGISTRY_STATUS_ERROR;
 		error_dialog(_("Couldn't get the plug-ins registry list."));
+		return;
 	}
-	registry_update_spinner();
+
+	g_warning("registry: background fetch failed");
+	registry.background = FALSE;
+	registry.status = registry.loaded ? REGISTRY_STATUS_LOADED :
+		REGISTRY_STATUS_NOT_LOADED;
 }
 
 static void error_dialog(const gchar *msg)
@@ -825,75 +2712,161 @@ static void notice_dialog(const gchar *msg)
 	gtk_widget_show(dialog);
 }
 
-static void registry_fetch_cb(GPid pid, gint status, gpointer data)
+static void registry_fetch_cb(Transfer *transfer, gpointer data)
 {
+	RegistryMirror *mirror = data;
+	gboolean current;
+
 	debug_print("registry_fetch_cb\n");
-	registry_load();
-	if (registry.status == REGISTRY_STATUS_ERROR) {
-		error_dialog(_("Couldn't get the plug-ins registry list."));
+	/* a response without a body wins as it completes */
+	if (transfer->status == 0 && !registry.fetch_winner)
+		registry_fetch_win(transfer);
+	registry.fetches = g_slist_remove(registry.fetches, transfer);
+
+	if (transfer->status < 0) {
+		registry_mirror_fail(mirror);
+		/* nothing was used from it, so wait for the other request or
+		 * try the next mirror */
+		if (transfer != registry.fetch_winner &&
+		    (registry.fetches || registry_fetch_next() == 0))
+			return;
+	}
+	registry_mirrors_save();
+
+	if (transfer->status == 0 && !TRANSFER_NOT_MODIFIED(transfer) &&
+	    strcmp(transfer->outfile, registry.tmp_file) != 0 &&
+	    rename_force(transfer->outfile, registry.tmp_file) < 0) {
+		FILE_OP_ERROR(registry.tmp_file, "rename");
+		transfer->status = -1;
 	}
+	registry_fetch_reset();
+
+	if (transfer->status < 0) {
+		/* keep what was streamed, and the rest of the old list */
+		registry_parse_cancel();
+		registry.status = REGISTRY_STATUS_ERROR;
+	} else if (TRANSFER_NOT_MODIFIED(transfer)) {
+		/* the cached copy is still current */
+		debug_print("registry not modified\n");
+		current = registry_cache_is_current(registry.cache_file,
+				registry.tmp_file);
+		if (g_utime(registry.tmp_file, NULL) < 0)
+			FILE_OP_ERROR(registry.tmp_file, "g_utime");
+		else if (current)
+			registry_cache_restamp(registry.cache_file,
+					registry.tmp_file);
+		if (registry.loaded) {
+			registry_parse_cancel();
+			registry.status = REGISTRY_STATUS_LOADED;
+		} else {
+			registry_load();
+		}
+	} else {
+		/* the rest is applied, and the cache compiled, once the parser
+		 * is through it */
+		registry_meta_write(transfer->etag, transfer->last_modified,
+				transfer->url);
+		g_free(registry.index_url);
+		registry.index_url = g_strdup(transfer->url);
+		if (registry.stream_buf->len > 0)
+			registry_parser_push_data(registry.parser,
+					registry.stream_buf->str,
+					registry.stream_buf->len);
+		registry_parser_end(registry.parser);
+	}
+	registry_stream_free();
+	if (registry.status == REGISTRY_STATUS_ERROR)
+		registry_fetch_error();
 
 	registry_update_spinner();
-	g_spawn_close_pid(pid);
+	registry_stats_dump();
 }
 
-/* Get the installed version of a plugin */
-static GModule *get_installed_syl_plugin_module(const gchar *name)
+/* Save the stats for diagnosis, and show them if the panel is open */
+static void registry_stats_dump(void)
+{
+	stats_dump(registry.stats_file);
+	registry_stats_update();
+}
+
+static void registry_stats_update(void)
+{
+	gchar *text;
+
+	if (!pman.stats_label)
+		return;
+
+	text = stats_to_string();
+	gtk_label_set_text(GTK_LABEL(pman.stats_label), text);
+	g_free(text);
+}
+
+static void registry_stats_expanded_cb(GObject *obj, GParamSpec *pspec,
+		gpointer data)
+{
+	if (gtk_expander_get_expanded(GTK_EXPANDER(obj)))
+		registry_stats_update();
+}
+
+/* Index the loaded modules, so that looking up every plugin of the
+ * registry does not walk the module list each time */
+static void modules_build(void)
 {
 	GSList *cur;
 	GModule *module;
 	SylPluginInfo *info;
+	const gchar *file;
+
+	modules.by_name = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	modules.by_file = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
 
 	for (cur = syl_plugin_get_module_list(); cur; cur = cur->next) {
 		module = cur->data;
 		info = syl_plugin_get_info(module);
-		if (info && !g_strcmp0(info->name, name))
-			return module;
+		/* the first module with a name wins, as with a scan */
+		if (info && info->name &&
+		    !g_hash_table_lookup(modules.by_name, info->name))
+			g_hash_table_insert(modules.by_name,
+					g_strdup(info->name), module);
+		file = g_module_name(module);
+		if (file)
+			g_hash_table_insert(modules.by_file, g_strdup(file),
+					module);
 	}
-
-	return NULL;
 }
 
-static gint compare_versions(struct version a, struct version b)
+/* Forget the index, after plugins are loaded, installed or removed */
+static void modules_invalidate(void)
 {
-	debug_print("comparing %d.%d.%d.%s <> %d.%d.%d.%s\n",
-		    a.major, a.minor, a.micro, a.extra,
-		    b.major, b.minor, b.micro, b.extra);
-
-	return
-		a.major > b.major ? 1 :
-		a.major < b.major ? -1 :
-		a.minor > b.minor ? 1 :
-		a.minor < b.minor ? -1 :
-		a.micro > b.micro ? 1 :
-		a.micro < b.micro ? -1 :
-		g_strcmp0(a.extra, b.extra);
+	if (modules.by_name) {
+		g_hash_table_destroy(modules.by_name);
+		modules.by_name = NULL;
+	}
+	if (modules.by_file) {
+		g_hash_table_destroy(modules.by_file);
+		modules.by_file = NULL;
+	}
 }
 
-static struct version version_from_string(const gchar *str)
+/* Get the installed version of a plugin */
+static GModule *get_installed_syl_plugin_module(const gchar *name)
 {
-	struct version ver = {0};
+	if (!name)
+		return NULL;
+	if (!modules.by_name)
+		modules_build();
 
-	if (str) {
-		ver.major = atoi(str);
-		if ((str = strchr(str, '.'))) {
-			ver.minor = atoi(++str);
-			if ((str = strchr(str, '.'))) {
-				ver.micro = atoi(++str);
-				while (isdigit(*str))
-					str++;
-				ver.extra = str;
-			}
-		}
-	}
-	return ver;
+	return g_hash_table_lookup(modules.by_name, name);
 }
 
-static gint compare_syl_plugin_versions(SylPluginInfo *a, SylPluginInfo *b)
+static GModule *get_installed_syl_plugin_module_by_file(const gchar *file)
 {
-	return !a && !b ? 0 :
-		a && !b ? 1 :
-		!a && b ? -1 :
-		compare_versions(version_from_string(a->version),
-				version_from_string(b->version));
+	if (!file)
+		return NULL;
+	if (!modules.by_file)
+		modules_build();
+
+	return g_hash_table_lookup(modules.by_file, file);
 }
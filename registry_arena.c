@@ -0,0 +1,94 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory of a generation of the registry.
+ *
+ * The infos parsed together are allocated from blocks of an arena, and
+ * their strings are interned in it, so that an author or license repeated
+ * across the registry is kept once. Nothing is freed on its own: each info
+ * holds a reference, and the arena is released in one step when the last
+ * info of the generation is. Only the reference count is thread safe; an
+ * arena is filled by one thread at a time.
+ */
+
+#include <glib.h>
+
+#include "registry_arena.h"
+
+#define ARENA_BLOCK_SIZE 16384
+#define ARENA_ALIGN 16
+
+struct _RegistryArena {
+	GStringChunk *strings;
+	GSList *blocks;
+	gsize used;
+	gint ref_count;
+};
+
+RegistryArena *registry_arena_new(void)
+{
+	RegistryArena *arena = g_new0(RegistryArena, 1);
+
+	arena->strings = g_string_chunk_new(ARENA_BLOCK_SIZE);
+	arena->ref_count = 1;
+
+	return arena;
+}
+
+RegistryArena *registry_arena_ref(RegistryArena *arena)
+{
+	g_atomic_int_inc(&arena->ref_count);
+	return arena;
+}
+
+void registry_arena_unref(RegistryArena *arena)
+{
+	if (!arena || !g_atomic_int_dec_and_test(&arena->ref_count))
+		return;
+	g_slist_free_full(arena->blocks, g_free);
+	g_string_chunk_free(arena->strings);
+	g_free(arena);
+}
+
+/* Get zeroed memory for a record, which lasts as long as the arena */
+gpointer registry_arena_alloc(RegistryArena *arena, gsize size)
+{
+	gpointer mem;
+
+	g_return_val_if_fail(size <= ARENA_BLOCK_SIZE, NULL);
+
+	size = (size + ARENA_ALIGN - 1) & ~(gsize)(ARENA_ALIGN - 1);
+	if (!arena->blocks || arena->used + size > ARENA_BLOCK_SIZE) {
+		arena->blocks = g_slist_prepend(arena->blocks,
+				g_malloc0(ARENA_BLOCK_SIZE));
+		arena->used = 0;
+	}
+	mem = (gchar *)arena->blocks->data + arena->used;
+	arena->used += size;
+
+	return mem;
+}
+
+/* Get the copy of a string in the arena, shared with equal strings */
+const gchar *registry_arena_intern(RegistryArena *arena, const gchar *str)
+{
+	if (!str)
+		return NULL;
+	return g_string_chunk_insert_const(arena->strings, str);
+}
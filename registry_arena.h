@@ -0,0 +1,32 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_ARENA_H__
+#define __REGISTRY_ARENA_H__
+
+#include <glib.h>
+
+typedef struct _RegistryArena RegistryArena;
+
+RegistryArena *registry_arena_new(void);
+RegistryArena *registry_arena_ref(RegistryArena *arena);
+void registry_arena_unref(RegistryArena *arena);
+gpointer registry_arena_alloc(RegistryArena *arena, gsize size);
+const gchar *registry_arena_intern(RegistryArena *arena, const gchar *str);
+
+#endif /* __REGISTRY_ARENA_H__ */
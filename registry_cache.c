@@ -0,0 +1,346 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compiled form of the registry, read through a memory map.
+ *
+ * The file is a header, followed by an array of records of
+ * N_REGISTRY_FIELDS offsets into the string table, followed by the string
+ * table of NUL-terminated, deduplicated strings. All integers are little
+ * endian, and 32-bit but for the stamp. The tag identifies what the
+ * registry was compiled for (platform, locale), and a cache with another
+ * tag is ignored. The stamp is the modification time and size of the
+ * registry file the cache was compiled from, which it stands for as long
+ * as both are the same.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+#include "registry_cache.h"
+
+#define REGISTRY_CACHE_MAGIC "SYLREGC"
+#define REGISTRY_CACHE_VERSION 5
+#define REGISTRY_CACHE_NULL G_MAXUINT32
+
+typedef struct _RegistryCacheHeader {
+	gchar magic[8];
+	guint32 version;
+	guint32 n_fields;
+	guint32 n_records;
+	guint32 strings_size;
+	guint32 tag;
+	guint32 reserved;
+	guint64 source_mtime;
+	guint64 source_size;
+} RegistryCacheHeader;
+
+struct _RegistryCache {
+	GMappedFile *map;
+	const guint32 *records;
+	const gchar *strings;
+	guint32 n_records;
+	guint32 strings_size;
+	gint ref_count;
+};
+
+struct _RegistryCacheWriter {
+	GArray *records;
+	GString *strings;
+	GHashTable *offsets;
+	guint32 tag;
+	guint64 source_mtime;
+	guint64 source_size;
+};
+
+static gboolean registry_cache_stat_source(const gchar *source,
+		guint64 *mtime, guint64 *size)
+{
+	GStatBuf s;
+
+	if (g_stat(source, &s) < 0)
+		return FALSE;
+	*mtime = (guint64)s.st_mtime;
+	*size = (guint64)s.st_size;
+	return TRUE;
+}
+
+static gboolean registry_cache_read_header(FILE *fp,
+		RegistryCacheHeader *header)
+{
+	return fread(header, sizeof *header, 1, fp) == 1 &&
+		memcmp(header->magic, REGISTRY_CACHE_MAGIC,
+			sizeof header->magic) == 0 &&
+		GUINT32_FROM_LE(header->version) == REGISTRY_CACHE_VERSION;
+}
+
+RegistryCache *registry_cache_open(const gchar *file, const gchar *tag)
+{
+	RegistryCache *cache;
+	GMappedFile *map;
+	GError *error = NULL;
+	const RegistryCacheHeader *header;
+	const gchar *contents;
+	gsize length, records_size;
+	guint32 n_records, strings_size, tag_offset;
+
+	map = g_mapped_file_new(file, FALSE, &error);
+	if (!map) {
+		debug_print("registry cache: %s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	contents = g_mapped_file_get_contents(map);
+	length = g_mapped_file_get_length(map);
+	header = (const RegistryCacheHeader *)contents;
+
+	if (length < sizeof *header ||
+	    memcmp(header->magic, REGISTRY_CACHE_MAGIC,
+		    sizeof header->magic) != 0 ||
+	    GUINT32_FROM_LE(header->version) != REGISTRY_CACHE_VERSION ||
+	    GUINT32_FROM_LE(header->n_fields) != N_REGISTRY_FIELDS)
+		goto invalid;
+
+	n_records = GUINT32_FROM_LE(header->n_records);
+	strings_size = GUINT32_FROM_LE(header->strings_size);
+	records_size = (gsize)n_records * N_REGISTRY_FIELDS * sizeof(guint32);
+	if (length != sizeof *header + records_size + strings_size ||
+	    strings_size == 0 || contents[length - 1] != '\0')
+		goto invalid;
+
+	cache = g_new0(RegistryCache, 1);
+	cache->map = map;
+	cache->records = (const guint32 *)(contents + sizeof *header);
+	cache->strings = contents + sizeof *header + records_size;
+	cache->n_records = n_records;
+	cache->strings_size = strings_size;
+	cache->ref_count = 1;
+
+	tag_offset = GUINT32_FROM_LE(header->tag);
+	if (tag_offset >= strings_size ||
+	    g_strcmp0(cache->strings + tag_offset, tag) != 0) {
+		debug_print("registry cache: %s has a different tag\n", file);
+		registry_cache_unref(cache);
+		return NULL;
+	}
+
+	return cache;
+
+invalid:
+	g_warning("registry cache: %s is invalid", file);
+	g_mapped_file_unref(map);
+	return NULL;
+}
+
+/* Whether a cache was compiled from source as it is now */
+gboolean registry_cache_is_current(const gchar *file, const gchar *source)
+{
+	RegistryCacheHeader header;
+	guint64 mtime, size;
+	gboolean current;
+	FILE *fp;
+
+	if (!registry_cache_stat_source(source, &mtime, &size))
+		return FALSE;
+	if ((fp = g_fopen(file, "rb")) == NULL)
+		return FALSE;
+
+	current = registry_cache_read_header(fp, &header) &&
+		GUINT64_FROM_LE(header.source_mtime) == mtime &&
+		GUINT64_FROM_LE(header.source_size) == size;
+	fclose(fp);
+
+	return current;
+}
+
+/* Stamp a current cache with the source again, after the source was
+ * touched without changing. The header is rewritten in place, as readers
+ * don't look at the stamp once the cache is open. */
+gint registry_cache_restamp(const gchar *file, const gchar *source)
+{
+	RegistryCacheHeader header;
+	guint64 mtime, size;
+	FILE *fp;
+	gint ret = -1;
+
+	if (!registry_cache_stat_source(source, &mtime, &size))
+		return -1;
+	if ((fp = g_fopen(file, "r+b")) == NULL)
+		return -1;
+
+	if (registry_cache_read_header(fp, &header)) {
+		header.source_mtime = GUINT64_TO_LE(mtime);
+		header.source_size = GUINT64_TO_LE(size);
+		if (fseek(fp, 0, SEEK_SET) == 0 &&
+		    fwrite(&header, sizeof header, 1, fp) == 1)
+			ret = 0;
+	}
+	if (fclose(fp) == EOF)
+		ret = -1;
+
+	return ret;
+}
+
+/* infos of a cache may be made on one thread and freed on another, so
+ * the count is atomic */
+RegistryCache *registry_cache_ref(RegistryCache *cache)
+{
+	g_atomic_int_inc(&cache->ref_count);
+	return cache;
+}
+
+void registry_cache_unref(RegistryCache *cache)
+{
+	if (!cache || !g_atomic_int_dec_and_test(&cache->ref_count))
+		return;
+	g_mapped_file_unref(cache->map);
+	g_free(cache);
+}
+
+guint registry_cache_get_length(RegistryCache *cache)
+{
+	return cache->n_records;
+}
+
+/* Get a field of a record, pointing into the mapped file */
+const gchar *registry_cache_get(RegistryCache *cache, guint record,
+		RegistryField field)
+{
+	guint32 offset;
+
+	g_return_val_if_fail(record < cache->n_records, NULL);
+
+	offset = GUINT32_FROM_LE(cache->records[record * N_REGISTRY_FIELDS +
+			field]);
+	if (offset >= cache->strings_size)
+		return NULL;
+
+	return cache->strings + offset;
+}
+
+static guint32 registry_cache_writer_intern(RegistryCacheWriter *writer,
+		const gchar *str)
+{
+	gpointer offset;
+
+	if (!str)
+		return REGISTRY_CACHE_NULL;
+
+	if (g_hash_table_lookup_extended(writer->offsets, str, NULL, &offset))
+		return GPOINTER_TO_UINT(offset);
+
+	offset = GUINT_TO_POINTER(writer->strings->len);
+	g_string_append_len(writer->strings, str, strlen(str) + 1);
+	g_hash_table_insert(writer->offsets, g_strdup(str), offset);
+
+	return GPOINTER_TO_UINT(offset);
+}
+
+RegistryCacheWriter *registry_cache_writer_new(const gchar *tag)
+{
+	RegistryCacheWriter *writer = g_new0(RegistryCacheWriter, 1);
+
+	writer->records = g_array_new(FALSE, FALSE, sizeof(guint32));
+	writer->strings = g_string_new(NULL);
+	writer->offsets = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	writer->tag = registry_cache_writer_intern(writer, tag);
+
+	return writer;
+}
+
+void registry_cache_writer_add(RegistryCacheWriter *writer,
+		const gchar *fields[N_REGISTRY_FIELDS])
+{
+	guint32 offset;
+	gint i;
+
+	for (i = 0; i < N_REGISTRY_FIELDS; i++) {
+		offset = GUINT32_TO_LE(registry_cache_writer_intern(writer,
+					fields[i]));
+		g_array_append_val(writer->records, offset);
+	}
+}
+
+/* Stamp the cache with the registry file it is compiled from */
+void registry_cache_writer_set_source(RegistryCacheWriter *writer,
+		const gchar *source)
+{
+	if (!registry_cache_stat_source(source, &writer->source_mtime,
+				&writer->source_size)) {
+		writer->source_mtime = 0;
+		writer->source_size = 0;
+	}
+}
+
+guint registry_cache_writer_get_length(RegistryCacheWriter *writer)
+{
+	return writer->records->len / N_REGISTRY_FIELDS;
+}
+
+gint registry_cache_writer_write(RegistryCacheWriter *writer,
+		const gchar *file)
+{
+	RegistryCacheHeader header = {{0}};
+	GString *data;
+	GError *error = NULL;
+	gint ret = 0;
+
+	memcpy(header.magic, REGISTRY_CACHE_MAGIC, sizeof header.magic);
+	header.version = GUINT32_TO_LE(REGISTRY_CACHE_VERSION);
+	header.n_fields = GUINT32_TO_LE(N_REGISTRY_FIELDS);
+	header.n_records = GUINT32_TO_LE(writer->records->len /
+			N_REGISTRY_FIELDS);
+	header.strings_size = GUINT32_TO_LE(writer->strings->len);
+	header.tag = GUINT32_TO_LE(writer->tag);
+	header.source_mtime = GUINT64_TO_LE(writer->source_mtime);
+	header.source_size = GUINT64_TO_LE(writer->source_size);
+
+	data = g_string_sized_new(sizeof header +
+			writer->records->len * sizeof(guint32) +
+			writer->strings->len);
+	g_string_append_len(data, (const gchar *)&header, sizeof header);
+	g_string_append_len(data, writer->records->data,
+			writer->records->len * sizeof(guint32));
+	g_string_append_len(data, writer->strings->str, writer->strings->len);
+
+	/* written to a temp file and renamed, so that maps of the previous
+	 * cache stay valid */
+	if (!g_file_set_contents(file, data->str, data->len, &error)) {
+		g_warning("registry cache: %s", error->message);
+		g_error_free(error);
+		ret = -1;
+	}
+
+	g_string_free(data, TRUE);
+
+	return ret;
+}
+
+void registry_cache_writer_free(RegistryCacheWriter *writer)
+{
+	g_array_free(writer->records, TRUE);
+	g_string_free(writer->strings, TRUE);
+	g_hash_table_destroy(writer->offsets);
+	g_free(writer);
+}
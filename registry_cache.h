@@ -0,0 +1,62 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_CACHE_H__
+#define __REGISTRY_CACHE_H__
+
+#include <glib.h>
+
+typedef enum {
+	REGISTRY_FIELD_ID,
+	REGISTRY_FIELD_NAME,
+	REGISTRY_FIELD_VERSION,
+	REGISTRY_FIELD_DESCRIPTION,
+	REGISTRY_FIELD_AUTHOR,
+	REGISTRY_FIELD_URL,
+	REGISTRY_FIELD_LICENSE,
+	REGISTRY_FIELD_INSTALL_URL,
+	REGISTRY_FIELD_INSTALL_SHA1SUM,
+	REGISTRY_FIELD_INSTALL_SHA256SUM,
+	REGISTRY_FIELD_INSTALL_DELTAS,
+	REGISTRY_FIELD_DETAILS_URL,
+	N_REGISTRY_FIELDS
+} RegistryField;
+
+typedef struct _RegistryCache RegistryCache;
+typedef struct _RegistryCacheWriter RegistryCacheWriter;
+
+RegistryCache *registry_cache_open(const gchar *file, const gchar *tag);
+gboolean registry_cache_is_current(const gchar *file, const gchar *source);
+gint registry_cache_restamp(const gchar *file, const gchar *source);
+RegistryCache *registry_cache_ref(RegistryCache *cache);
+void registry_cache_unref(RegistryCache *cache);
+guint registry_cache_get_length(RegistryCache *cache);
+const gchar *registry_cache_get(RegistryCache *cache, guint record,
+		RegistryField field);
+
+RegistryCacheWriter *registry_cache_writer_new(const gchar *tag);
+void registry_cache_writer_add(RegistryCacheWriter *writer,
+		const gchar *fields[N_REGISTRY_FIELDS]);
+void registry_cache_writer_set_source(RegistryCacheWriter *writer,
+		const gchar *source);
+guint registry_cache_writer_get_length(RegistryCacheWriter *writer);
+gint registry_cache_writer_write(RegistryCacheWriter *writer,
+		const gchar *file);
+void registry_cache_writer_free(RegistryCacheWriter *writer);
+
+#endif /* __REGISTRY_CACHE_H__ */
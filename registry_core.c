@@ -0,0 +1,881 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The registry logic that does not depend on the user interface: parsing
+ * the registry and diffing its generations, comparing versions, and
+ * verifying and installing plug-in files.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "utils.h"
+#include "registry_core.h"
+
+#define VERSION_PART_BITS 20
+#define VERSION_PART_MAX ((G_GUINT64_CONSTANT(1) << VERSION_PART_BITS) - 1)
+
+/* Delta patches are our own format, laid out like bsdiff 4.3 but with
+ * its blocks uncompressed, so they get a magic of their own: these 15
+ * characters and a NUL. Then come the size of the new file as an 8-byte
+ * integer, and the control triples each followed by its blocks. Integers
+ * are little-endian magnitudes with the sign in the top bit. */
+#define DELTA_MAGIC "SYLREG/BSDIFF43"
+#define DELTA_MAGIC_LEN sizeof(DELTA_MAGIC)
+#define DELTA_MAX_SIZE G_MAXINT32
+
+static gboolean version_is_identifier_end(gchar c)
+{
+	return c == '.' || c == '+' || c == '\0';
+}
+
+/* Order dot-separated pre-release identifiers as in semver: numeric ones
+ * numerically and below alphanumeric ones, which are ordered in ASCII,
+ * and a shorter list of otherwise equal identifiers first */
+static gint compare_prereleases(const gchar *a, const gchar *b)
+{
+	gsize a_len, b_len, a_digits, b_digits;
+	gint cmp;
+
+	for (;;) {
+		if (*a == '+' || *a == '\0')
+			return *b == '+' || *b == '\0' ? 0 : -1;
+		if (*b == '+' || *b == '\0')
+			return 1;
+
+		for (a_len = a_digits = 0; !version_is_identifier_end(a[a_len]);
+				a_len++)
+			if (g_ascii_isdigit(a[a_len]))
+				a_digits++;
+		for (b_len = b_digits = 0; !version_is_identifier_end(b[b_len]);
+				b_len++)
+			if (g_ascii_isdigit(b[b_len]))
+				b_digits++;
+
+		if (a_digits == a_len && b_digits == b_len) {
+			/* numbers without leading zeros: longer is larger */
+			while (a_len > 1 && *a == '0') {
+				a++;
+				a_len--;
+			}
+			while (b_len > 1 && *b == '0') {
+				b++;
+				b_len--;
+			}
+			if (a_len != b_len)
+				return a_len > b_len ? 1 : -1;
+			cmp = memcmp(a, b, a_len);
+		} else if (a_digits == a_len) {
+			return -1;
+		} else if (b_digits == b_len) {
+			return 1;
+		} else {
+			cmp = memcmp(a, b, MIN(a_len, b_len));
+			if (cmp == 0 && a_len != b_len)
+				return a_len > b_len ? 1 : -1;
+		}
+		if (cmp != 0)
+			return cmp > 0 ? 1 : -1;
+
+		a += a_len;
+		b += b_len;
+		if (*a == '.')
+			a++;
+		if (*b == '.')
+			b++;
+	}
+}
+
+gint registry_version_compare(RegistryVersion a, RegistryVersion b)
+{
+	if (a.key != b.key)
+		return a.key > b.key ? 1 : -1;
+
+	/* equal keys are either both releases or both pre-releases */
+	return a.pre ? compare_prereleases(a.pre, b.pre) : 0;
+}
+
+/* Parse a version like 1.2.3-rc.1+build. Missing parts are 0, and a
+ * suffix without a hyphen, as in 1.0beta, is taken as a pre-release. */
+RegistryVersion registry_version_parse(const gchar *str)
+{
+	RegistryVersion ver = {0, NULL};
+	guint64 part[3] = {0, 0, 0};
+	gint i;
+
+	if (str) {
+		for (i = 0; i < 3; i++) {
+			for (; g_ascii_isdigit(*str); str++)
+				if (part[i] <= VERSION_PART_MAX)
+					part[i] = part[i] * 10 + (*str - '0');
+			part[i] = MIN(part[i], VERSION_PART_MAX);
+			if (i == 2 || str[0] != '.' ||
+			    !g_ascii_isdigit(str[1]))
+				break;
+			str++;
+		}
+		/* ignore any further numeric parts */
+		while (str[0] == '.' && g_ascii_isdigit(str[1]))
+			for (str++; g_ascii_isdigit(*str); str++)
+				;
+
+		if (*str == '-')
+			str++;
+		if (*str != '+' && *str != '\0')
+			ver.pre = str;
+	}
+
+	ver.key = part[0] << (2 * VERSION_PART_BITS + 1) |
+		part[1] << (VERSION_PART_BITS + 1) |
+		part[2] << 1 |
+		(ver.pre ? 0 : 1);
+
+	return ver;
+}
+
+/* intern a string read from a key file in the arena, freeing it. without
+ * an arena, the string is kept. */
+static gchar *registry_arena_take(RegistryArena *arena, gchar *str)
+{
+	const gchar *copy;
+
+	if (!arena)
+		return str;
+	copy = registry_arena_intern(arena, str);
+
+	g_free(str);
+	return (gchar *)copy;
+}
+
+static gchar *registry_key_file_get(GKeyFile *key_file, const gchar *group,
+		const gchar *key, RegistryArena *arena)
+{
+	return registry_arena_take(arena,
+			g_key_file_get_string(key_file, group, key, NULL));
+}
+
+/* collect the delta patches of a plugin as lines of "from-sum url" */
+static gchar *registry_parse_deltas(GKeyFile *key_file, const gchar *group,
+		gchar **keys)
+{
+	gchar **key, *url;
+	GString *deltas = NULL;
+	gsize prefix_len = strlen(REGISTRY_INSTALL_DELTA_KEY_PREFIX);
+
+	for (key = keys; *key; key++) {
+		if (strncmp(*key, REGISTRY_INSTALL_DELTA_KEY_PREFIX,
+					prefix_len) != 0)
+			continue;
+		url = g_key_file_get_string(key_file, group, *key, NULL);
+		if (!url)
+			continue;
+		if (!deltas)
+			deltas = g_string_new(NULL);
+		g_string_append_printf(deltas, "%s %s\n",
+				*key + prefix_len, url);
+		g_free(url);
+	}
+
+	return deltas ? g_string_free(deltas, FALSE) : NULL;
+}
+
+/* If key is base[locale] for a language of the user preferred to the best
+ * key so far, make it the best */
+static void registry_pick_locale_key(const gchar *key, const gchar *base,
+		const gchar * const *langs, const gchar **best, gint *best_rank)
+{
+	gsize len = strlen(base), n;
+	gint i;
+
+	if (strncmp(key, base, len) != 0 || key[len] != '[')
+		return;
+	n = strlen(key + len + 1);
+	if (n < 2 || key[len + n] != ']')
+		return;
+	n--;
+
+	for (i = 0; langs[i] && i < *best_rank; i++) {
+		if (strlen(langs[i]) == n &&
+		    strncmp(langs[i], key + len + 1, n) == 0) {
+			*best = key;
+			*best_rank = i;
+			return;
+		}
+	}
+}
+
+/* Load a plugin info from a group of a registry key file into an arena,
+ * or with fields of its own if arena is NULL. The keys are scanned once:
+ * the translations of the name and description are chosen from them as
+ * g_key_file_get_locale_string() would, and the install fields are only
+ * read if the plugin has a binary for this platform. */
+RegistryPluginInfo *registry_plugin_info_new_from_key_file(
+		GKeyFile *key_file, const gchar *group, RegistryArena *arena)
+{
+	RegistryPluginInfo *info = arena ?
+		registry_arena_alloc(arena, sizeof *info) :
+		g_new0(RegistryPluginInfo, 1);
+	const gchar * const *langs = g_get_language_names();
+	const gchar *name_key = "name", *description_key = "description";
+	gint name_rank = G_MAXINT, description_rank = G_MAXINT;
+	gboolean has_install = FALSE;
+	gchar **keys, **key;
+
+	keys = g_key_file_get_keys(key_file, group, NULL, NULL);
+	if (!keys)
+		keys = g_new0(gchar *, 1);
+	for (key = keys; *key; key++) {
+		if (strcmp(*key, REGISTRY_INSTALL_URL_KEY) == 0) {
+			has_install = TRUE;
+		} else if (strchr(*key, '[')) {
+			registry_pick_locale_key(*key, "name", langs,
+					&name_key, &name_rank);
+			registry_pick_locale_key(*key, "description", langs,
+					&description_key, &description_rank);
+		}
+	}
+
+	info->name = registry_key_file_get(key_file, group, name_key, arena);
+	info->version = registry_key_file_get(key_file, group, "version",
+			arena);
+	info->description = registry_key_file_get(key_file, group,
+			description_key, arena);
+	info->author = registry_key_file_get(key_file, group, "author",
+			arena);
+	info->url = registry_key_file_get(key_file, group, "url", arena);
+	info->license = registry_key_file_get(key_file, group, "license",
+			arena);
+	info->details_url = registry_key_file_get(key_file, group,
+			REGISTRY_DETAILS_KEY, arena);
+	if (has_install) {
+		info->install_url = registry_key_file_get(key_file, group,
+				REGISTRY_INSTALL_URL_KEY, arena);
+		info->install_sha1sum = registry_key_file_get(key_file, group,
+				REGISTRY_INSTALL_SHA1SUM_KEY, arena);
+		info->install_sha256sum = registry_key_file_get(key_file,
+				group, REGISTRY_INSTALL_SHA256SUM_KEY, arena);
+		info->install_deltas = registry_arena_take(arena,
+				registry_parse_deltas(key_file, group, keys));
+	}
+	g_strfreev(keys);
+	if (arena) {
+		info->id = (gchar *)registry_arena_intern(arena, group);
+		info->arena = registry_arena_ref(arena);
+	} else {
+		info->id = g_strdup(group);
+	}
+	info->parsed_version = registry_version_parse(info->version);
+
+	return info;
+}
+
+/* Load a plugin info into an arena, with its strings staying in the mapped
+ * registry cache */
+RegistryPluginInfo *registry_plugin_info_new_from_cache(
+		RegistryCache *cache, guint record, RegistryArena *arena)
+{
+	RegistryPluginInfo *info = registry_arena_alloc(arena, sizeof *info);
+
+#define CACHE_FIELD(field) \
+	(gchar *)registry_cache_get(cache, record, REGISTRY_FIELD_##field)
+	info->id = CACHE_FIELD(ID);
+	info->name = CACHE_FIELD(NAME);
+	info->version = CACHE_FIELD(VERSION);
+	info->description = CACHE_FIELD(DESCRIPTION);
+	info->author = CACHE_FIELD(AUTHOR);
+	info->url = CACHE_FIELD(URL);
+	info->license = CACHE_FIELD(LICENSE);
+	info->install_url = CACHE_FIELD(INSTALL_URL);
+	info->install_sha1sum = CACHE_FIELD(INSTALL_SHA1SUM);
+	info->install_sha256sum = CACHE_FIELD(INSTALL_SHA256SUM);
+	info->install_deltas = CACHE_FIELD(INSTALL_DELTAS);
+	info->details_url = CACHE_FIELD(DETAILS_URL);
+#undef CACHE_FIELD
+	info->cache = registry_cache_ref(cache);
+	info->arena = registry_arena_ref(arena);
+	info->parsed_version = registry_version_parse(info->version);
+
+	return info;
+}
+
+/* Load the whole info of a plugin listed in an index from its detail
+ * record, if the record is of the same version. The binary is the one of
+ * the index, which is fetched more often: if the record has another, as
+ * when it was cached before a rebuild, its deltas are to that one and are
+ * dropped. */
+RegistryPluginInfo *registry_plugin_info_new_from_details(
+		const gchar *file, RegistryPluginInfo *summary)
+{
+	GKeyFile *key_file = g_key_file_new();
+	RegistryPluginInfo *info = NULL;
+
+	/* loaded one at a time, so with fields of its own rather than an
+	 * arena sized for a generation */
+	if (g_key_file_load_from_file(key_file, file, G_KEY_FILE_NONE, NULL) &&
+	    g_key_file_has_group(key_file, summary->id)) {
+		info = registry_plugin_info_new_from_key_file(key_file,
+				summary->id, NULL);
+		g_free(info->details_url);
+		info->details_url = NULL;
+		if (g_strcmp0(info->version, summary->version) != 0) {
+			debug_print("details of %s are of another version\n",
+					summary->id);
+			registry_plugin_info_free(info);
+			info = NULL;
+		} else if (g_strcmp0(info->install_url,
+					summary->install_url) ||
+			   g_strcmp0(info->install_sha256sum,
+				   summary->install_sha256sum) ||
+			   g_strcmp0(info->install_sha1sum,
+				   summary->install_sha1sum)) {
+			debug_print("details of %s are of another binary\n",
+					summary->id);
+			g_free(info->install_url);
+			g_free(info->install_sha256sum);
+			g_free(info->install_sha1sum);
+			g_free(info->install_deltas);
+			info->install_url = g_strdup(summary->install_url);
+			info->install_sha256sum =
+				g_strdup(summary->install_sha256sum);
+			info->install_sha1sum =
+				g_strdup(summary->install_sha1sum);
+			info->install_deltas = NULL;
+		}
+	}
+	g_key_file_free(key_file);
+
+	return info;
+}
+
+/* Compare the registry fields of two infos for the same plugin */
+gboolean registry_plugin_info_equal(RegistryPluginInfo *a,
+		RegistryPluginInfo *b)
+{
+	return !g_strcmp0(a->name, b->name) &&
+		!g_strcmp0(a->version, b->version) &&
+		!g_strcmp0(a->description, b->description) &&
+		!g_strcmp0(a->author, b->author) &&
+		!g_strcmp0(a->url, b->url) &&
+		!g_strcmp0(a->license, b->license) &&
+		!g_strcmp0(a->install_url, b->install_url) &&
+		!g_strcmp0(a->install_sha1sum, b->install_sha1sum) &&
+		!g_strcmp0(a->install_sha256sum, b->install_sha256sum) &&
+		!g_strcmp0(a->install_deltas, b->install_deltas) &&
+		!g_strcmp0(a->details_url, b->details_url);
+}
+
+/* Carry over the state of a plugin from its previous info */
+void registry_plugin_info_adopt(RegistryPluginInfo *info,
+		RegistryPluginInfo *old)
+{
+	info->user_removed = old->user_removed;
+	info->in_progress = old->in_progress;
+	/* the batch is only ended by the install of this plugin */
+	info->in_batch = old->in_batch;
+	info->tmp_download_filename = old->tmp_download_filename;
+	old->tmp_download_filename = NULL;
+	if (!info->installed_filename) {
+		info->installed_filename = old->installed_filename;
+		old->installed_filename = NULL;
+	}
+}
+
+/* Free the state of an info, and release its arena; the registry fields
+ * go with the arena. An info made without one owns its fields. */
+void registry_plugin_info_free(RegistryPluginInfo *info)
+{
+	g_free(info->tmp_download_filename);
+	g_free(info->installed_filename);
+	if (info->arena) {
+		registry_cache_unref(info->cache);
+		registry_arena_unref(info->arena);
+		return;
+	}
+	g_free(info->name);
+	g_free(info->version);
+	g_free(info->description);
+	g_free(info->author);
+	g_free(info->id);
+	g_free(info->url);
+	g_free(info->license);
+	g_free(info->install_url);
+	g_free(info->install_sha1sum);
+	g_free(info->install_sha256sum);
+	g_free(info->install_deltas);
+	g_free(info->details_url);
+	g_free(info);
+}
+
+static GPtrArray *registry_parse(GKeyFile *key_file, RegistryArena *arena)
+{
+	gchar **groups, **group;
+	GPtrArray *infos;
+
+	groups = g_key_file_get_groups(key_file, NULL);
+	if (!groups)
+		return NULL;
+
+	infos = g_ptr_array_sized_new(g_strv_length(groups));
+	for (group = groups; *group; group++)
+		g_ptr_array_add(infos, registry_plugin_info_new_from_key_file(
+					key_file, *group, arena));
+	g_strfreev(groups);
+
+	return infos;
+}
+
+/* read the plugin infos from a registry key file into an arena */
+GPtrArray *registry_parse_key_file(const gchar *file, RegistryArena *arena)
+{
+	GKeyFile *key_file = g_key_file_new();
+	GError *error = NULL;
+	GPtrArray *infos;
+
+	if (!g_key_file_load_from_file(key_file, file, G_KEY_FILE_NONE,
+				&error)) {
+		g_warning("g_key_file_load_from_file: %s", error->message);
+		g_error_free(error);
+		g_key_file_free(key_file);
+		return NULL;
+	}
+
+	infos = registry_parse(key_file, arena);
+	g_key_file_free(key_file);
+
+	return infos;
+}
+
+/* read the plugin infos from a piece of a registry key file, made of
+ * complete sections, into an arena */
+GPtrArray *registry_parse_data(const gchar *data, gsize len,
+		RegistryArena *arena)
+{
+	GKeyFile *key_file = g_key_file_new();
+	GError *error = NULL;
+	GPtrArray *infos;
+
+	if (!g_key_file_load_from_data(key_file, data, len, G_KEY_FILE_NONE,
+				&error)) {
+		g_warning("g_key_file_load_from_data: %s", error->message);
+		g_error_free(error);
+		g_key_file_free(key_file);
+		return NULL;
+	}
+
+	infos = registry_parse(key_file, arena);
+	g_key_file_free(key_file);
+
+	return infos;
+}
+
+/* read the plugin infos from a compiled registry cache into an arena */
+GPtrArray *registry_parse_cache(const gchar *file, const gchar *tag,
+		RegistryArena *arena)
+{
+	RegistryCache *cache;
+	GPtrArray *infos;
+	guint i, n;
+
+	cache = registry_cache_open(file, tag);
+	if (!cache)
+		return NULL;
+
+	n = registry_cache_get_length(cache);
+	infos = g_ptr_array_sized_new(n);
+	for (i = 0; i < n; i++) {
+		if (!registry_cache_get(cache, i, REGISTRY_FIELD_ID))
+			continue;
+		g_ptr_array_add(infos,
+				registry_plugin_info_new_from_cache(cache, i,
+					arena));
+	}
+	registry_cache_unref(cache);
+
+	return infos;
+}
+
+/* add the registry fields of a plugin info to a cache being compiled */
+void registry_plugin_info_compile(RegistryPluginInfo *info,
+		RegistryCacheWriter *writer)
+{
+	const gchar *fields[N_REGISTRY_FIELDS];
+
+	fields[REGISTRY_FIELD_ID] = info->id;
+	fields[REGISTRY_FIELD_NAME] = info->name;
+	fields[REGISTRY_FIELD_VERSION] = info->version;
+	fields[REGISTRY_FIELD_DESCRIPTION] = info->description;
+	fields[REGISTRY_FIELD_AUTHOR] = info->author;
+	fields[REGISTRY_FIELD_URL] = info->url;
+	fields[REGISTRY_FIELD_LICENSE] = info->license;
+	fields[REGISTRY_FIELD_INSTALL_URL] = info->install_url;
+	fields[REGISTRY_FIELD_INSTALL_SHA1SUM] = info->install_sha1sum;
+	fields[REGISTRY_FIELD_INSTALL_SHA256SUM] =
+		info->install_sha256sum;
+	fields[REGISTRY_FIELD_INSTALL_DELTAS] = info->install_deltas;
+	fields[REGISTRY_FIELD_DETAILS_URL] = info->details_url;
+	registry_cache_writer_add(writer, fields);
+}
+
+/* compile the plugin infos into a registry cache */
+gint registry_cache_save(GPtrArray *infos, const gchar *file,
+		const gchar *tag)
+{
+	RegistryCacheWriter *writer;
+	guint i;
+	gint ret;
+
+	writer = registry_cache_writer_new(tag);
+	for (i = 0; i < infos->len; i++)
+		registry_plugin_info_compile(g_ptr_array_index(infos, i),
+				writer);
+
+	ret = registry_cache_writer_write(writer, file);
+	registry_cache_writer_free(writer);
+
+	return ret;
+}
+
+
+/* start a new generation of the registry, holding plugin infos by id */
+GHashTable *registry_generation_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, (GDestroyNotify)registry_plugin_info_free);
+}
+
+/* add a plugin to the next generation, and report whether it is new or
+ * changed since the previous one. takes the info; returns FALSE and
+ * frees it if the next generation has the plugin already. */
+gboolean registry_generation_add(GHashTable *next, GHashTable *prev,
+		RegistryPluginInfo *info, const RegistryDiffFuncs *funcs,
+		gpointer data)
+{
+	RegistryPluginInfo *old;
+
+	if (g_hash_table_lookup(next, info->id)) {
+		registry_plugin_info_free(info);
+		return FALSE;
+	}
+
+	old = prev ? g_hash_table_lookup(prev, info->id) : NULL;
+	if (old && info->details_url && !old->details_url &&
+	    !g_strcmp0(info->version, old->version) &&
+	    !g_strcmp0(info->install_url, old->install_url) &&
+	    !g_strcmp0(info->install_sha256sum, old->install_sha256sum) &&
+	    !g_strcmp0(info->install_sha1sum, old->install_sha1sum)) {
+		/* the details loaded for this version stand for its entry in
+		 * the index */
+		registry_plugin_info_free(info);
+		g_hash_table_steal(prev, old->id);
+		info = old;
+		if (funcs && funcs->update)
+			funcs->update(info, FALSE, data);
+	} else if (old) {
+		registry_plugin_info_adopt(info, old);
+		if (funcs && funcs->update)
+			funcs->update(info,
+					!registry_plugin_info_equal(info, old),
+					data);
+	} else if (funcs && funcs->add) {
+		funcs->add(info, g_hash_table_size(next), data);
+	}
+	info->position = g_hash_table_size(next);
+	g_hash_table_insert(next, info->id, info);
+
+	return TRUE;
+}
+
+/* report the plugins missing from the next generation as removed, and
+ * destroy the previous one. if the next generation is incomplete, or a
+ * plugin is being downloaded or is part of a batch, it is kept instead. */
+void registry_generation_finish(GHashTable *next, GHashTable *prev,
+		gboolean complete, const RegistryDiffFuncs *funcs,
+		gpointer data)
+{
+	RegistryPluginInfo *old;
+	GHashTableIter iter;
+
+	if (!prev)
+		return;
+
+	g_hash_table_iter_init(&iter, prev);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&old)) {
+		if (g_hash_table_lookup(next, old->id))
+			continue;
+		if (old->in_progress || old->in_batch || !complete) {
+			g_hash_table_iter_steal(&iter);
+			old->position = g_hash_table_size(next);
+			g_hash_table_insert(next, old->id, old);
+		} else if (funcs && funcs->remove) {
+			funcs->remove(old, data);
+		}
+	}
+	g_hash_table_destroy(prev);
+}
+
+/* Get the expected checksum of the plugin's binary, preferring SHA-256 */
+const gchar *registry_plugin_get_checksum(RegistryPluginInfo *info,
+		GChecksumType *type)
+{
+	if (info->install_sha256sum) {
+		*type = G_CHECKSUM_SHA256;
+		return info->install_sha256sum;
+	}
+	if (info->install_sha1sum) {
+		*type = G_CHECKSUM_SHA1;
+		return info->install_sha1sum;
+	}
+	return NULL;
+}
+
+/* Check the digest computed while downloading against the registry */
+gint registry_plugin_verify(RegistryPluginInfo *info, const gchar *digest)
+{
+	GChecksumType type;
+	const gchar *sum = registry_plugin_get_checksum(info, &type);
+
+	if (!sum || !digest)
+		return -1;
+
+	debug_print("checksum: %s. goal: %s\n", digest, sum);
+
+	return g_ascii_strcasecmp(sum, digest) == 0 ? 0 : -1;
+}
+
+/* Hash a file, as the installed binary of a plugin */
+gchar *registry_file_checksum(const gchar *file, GChecksumType type)
+{
+	GMappedFile *map;
+	GError *error = NULL;
+	gchar *sum;
+
+	map = g_mapped_file_new(file, FALSE, &error);
+	if (!map) {
+		debug_print("%s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	sum = g_compute_checksum_for_data(type,
+			(const guchar *)g_mapped_file_get_contents(map),
+			g_mapped_file_get_length(map));
+	g_mapped_file_unref(map);
+
+	return sum;
+}
+
+/* Find the delta patch from a binary with the given SHA-256 to the
+ * binary of this version */
+gchar *registry_plugin_get_delta_url(RegistryPluginInfo *info,
+		const gchar *from_sum)
+{
+	const gchar *line, *end;
+	gsize len;
+
+	if (!info->install_deltas || !from_sum)
+		return NULL;
+
+	len = strlen(from_sum);
+	for (line = info->install_deltas; *line; line = end + 1) {
+		end = strchr(line, '\n');
+		if (!end)
+			break;
+		if (g_ascii_strncasecmp(line, from_sum, len) == 0 &&
+		    line[len] == ' ')
+			return g_strndup(line + len + 1, end - line - len - 1);
+	}
+
+	return NULL;
+}
+
+/* Get the URL of the detail record of a plugin from an index. A relative
+ * URL is taken from the directory of base_url. */
+gchar *registry_plugin_get_details_url(RegistryPluginInfo *info,
+		const gchar *base_url)
+{
+	const gchar *slash;
+
+	if (!info->details_url)
+		return NULL;
+	if (strstr(info->details_url, "://") || !base_url ||
+	    !(slash = strrchr(base_url, '/')))
+		return g_strdup(info->details_url);
+
+	return g_strdup_printf("%.*s%s", (gint)(slash - base_url + 1),
+			base_url, info->details_url);
+}
+
+/* Read an integer of a patch, 8 bytes little endian, sign and magnitude */
+static gint64 delta_read_int(const guchar *buf)
+{
+	gint64 val = buf[7] & 0x7f;
+	gint i;
+
+	for (i = 6; i >= 0; i--)
+		val = val * 256 + buf[i];
+
+	return buf[7] & 0x80 ? -val : val;
+}
+
+/* Apply a delta patch to a file, updating the checksum with the result.
+ *
+ * The patch is in the format of DELTA_MAGIC: the magic, the size of the
+ * new file, then until it is complete, control triples of the length of
+ * a diff block, the length of an extra block and a seek in the old file,
+ * each followed by the blocks. Bytes of a diff block are added to those
+ * of the old file; extra blocks are copied as they are. Any compression
+ * of the patch is left to the transfer. A patch for a new file larger
+ * than max_size is refused. */
+gint registry_plugin_patch(const gchar *old_file, const gchar *patch_file,
+		const gchar *new_file, gint64 max_size, GChecksum *checksum)
+{
+	GMappedFile *old_map = NULL, *patch_map = NULL;
+	GError *error = NULL;
+	const guchar *old, *p, *end;
+	guchar *buf = NULL;
+	gint64 old_len, new_len, new_pos, old_pos, i;
+	gint64 diff_len, extra_len, seek;
+	gint ret = -1;
+
+	old_map = g_mapped_file_new(old_file, FALSE, &error);
+	if (old_map)
+		patch_map = g_mapped_file_new(patch_file, FALSE, &error);
+	if (!patch_map) {
+		g_warning("registry_plugin_patch: %s", error->message);
+		g_error_free(error);
+		goto out;
+	}
+
+	old = (const guchar *)g_mapped_file_get_contents(old_map);
+	old_len = g_mapped_file_get_length(old_map);
+	p = (const guchar *)g_mapped_file_get_contents(patch_map);
+	end = p + g_mapped_file_get_length(patch_map);
+
+	if (end - p < DELTA_MAGIC_LEN + 8 ||
+	    memcmp(p, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0)
+		goto invalid;
+	new_len = delta_read_int(p + DELTA_MAGIC_LEN);
+	p += DELTA_MAGIC_LEN + 8;
+	/* each byte of the new file is in a block of the patch */
+	if (new_len < 0 || new_len > DELTA_MAX_SIZE || new_len > end - p)
+		goto invalid;
+	if (new_len > max_size) {
+		g_warning("registry_plugin_patch: %s is too large", patch_file);
+		goto out;
+	}
+
+	buf = g_try_malloc(MAX(new_len, 1));
+	if (!buf) {
+		g_warning("registry_plugin_patch: out of memory");
+		goto out;
+	}
+	for (new_pos = old_pos = 0; new_pos < new_len; old_pos += seek) {
+		if (end - p < 24)
+			goto invalid;
+		diff_len = delta_read_int(p);
+		extra_len = delta_read_int(p + 8);
+		seek = delta_read_int(p + 16);
+		p += 24;
+		if (diff_len < 0 || extra_len < 0 ||
+		    diff_len > new_len - new_pos ||
+		    extra_len > new_len - new_pos - diff_len ||
+		    end - p < diff_len + extra_len ||
+		    seek < -DELTA_MAX_SIZE || seek > DELTA_MAX_SIZE)
+			goto invalid;
+
+		for (i = 0; i < diff_len; i++) {
+			buf[new_pos + i] = p[i];
+			if (old_pos + i >= 0 && old_pos + i < old_len)
+				buf[new_pos + i] += old[old_pos + i];
+		}
+		p += diff_len;
+		new_pos += diff_len;
+		old_pos += diff_len;
+
+		memcpy(buf + new_pos, p, extra_len);
+		p += extra_len;
+		new_pos += extra_len;
+	}
+
+	g_checksum_update(checksum, buf, new_len);
+	if (!g_file_set_contents(new_file, (const gchar *)buf, new_len,
+				&error)) {
+		g_warning("registry_plugin_patch: %s", error->message);
+		g_error_free(error);
+		goto out;
+	}
+	ret = 0;
+	goto out;
+
+invalid:
+	g_warning("registry_plugin_patch: %s is not a valid patch",
+			patch_file);
+out:
+	g_free(buf);
+	if (patch_map)
+		g_mapped_file_unref(patch_map);
+	if (old_map)
+		g_mapped_file_unref(old_map);
+
+	return ret;
+}
+
+/* Move a downloaded plugin file into the modules directory */
+gint registry_plugin_install(RegistryPluginInfo *info, const gchar *file,
+		const gchar *dir)
+{
+	gchar *dest;
+
+	dest = g_strconcat(dir, G_DIR_SEPARATOR_S,
+			info->id, ".", G_MODULE_SUFFIX, NULL);
+
+	debug_print("installing plugin from %s to %s\n", file, dest);
+
+	if (g_rename(file, dest) < 0) {
+		FILE_OP_ERROR(dest, "g_rename");
+		g_free(dest);
+		return -1;
+	}
+
+	g_free(info->installed_filename);
+	info->installed_filename = dest;
+
+	return 0;
+}
+
+gint registry_plugin_uninstall(RegistryPluginInfo *info)
+{
+	const gchar *filename = info->installed_filename;
+	int ret;
+
+	g_return_val_if_fail(filename != NULL, -1);
+
+	/* Delete the module file */
+	debug_print("unlinking %s\n", filename);
+	if (g_unlink(filename) < 0) {
+		FILE_OP_ERROR(filename, "g_unlink");
+		ret = -1;
+	} else {
+		info->user_removed = TRUE;
+		ret = 0;
+	}
+
+	return ret;
+}
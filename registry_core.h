@@ -0,0 +1,139 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_CORE_H__
+#define __REGISTRY_CORE_H__
+
+#include <glib.h>
+#include <gmodule.h>
+
+#include "registry_cache.h"
+#include "registry_arena.h"
+
+/* keys of the registry entries for the binaries of this platform */
+#define REGISTRY_INSTALL_URL_KEY PLATFORM "_url"
+#define REGISTRY_INSTALL_SHA1SUM_KEY PLATFORM "_sha1sum"
+#define REGISTRY_INSTALL_SHA256SUM_KEY PLATFORM "_sha256sum"
+
+/* prefix of the keys of delta patches, followed by the SHA-256 of the
+ * binary they apply to */
+#define REGISTRY_INSTALL_DELTA_KEY_PREFIX PLATFORM "_delta_"
+
+/* A version parsed for comparison. The key packs the major, minor and
+ * micro numbers, and whether it is a release, so that versions with
+ * different keys compare as integers. Equal keys of pre-releases are
+ * ordered by the pre-release identifiers, which point into the version
+ * string. Build metadata is ignored. */
+typedef struct _RegistryVersion {
+	guint64 key;
+	const gchar *pre;
+} RegistryVersion;
+
+/* key of an entry of a registry index, locating its detail record */
+#define REGISTRY_DETAILS_KEY "details"
+
+/* An entry of the registry. If arena is set, the info and its strings from
+ * the registry are in it, except for those pointing into the cache if that
+ * is set; otherwise they are owned. If details_url is set, the entry is
+ * from an index, with only the fields needed to list and install it, and
+ * the rest are in its detail record. The state after them is kept by the
+ * front end. */
+typedef struct _RegistryPluginInfo {
+	gchar *id;
+	gchar *name;
+	gchar *version;
+	gchar *description;
+	gchar *author;
+	gchar *url;
+	gchar *license;
+	gchar *install_url;
+	gchar *install_sha1sum;
+	gchar *install_sha256sum;
+	gchar *install_deltas;
+	gchar *details_url;
+	RegistryArena *arena;
+	RegistryCache *cache;
+	RegistryVersion parsed_version;
+	guint position;
+
+	GModule *installed_module;
+	RegistryVersion installed_version;
+	gchar *installed_filename;
+	gchar *tmp_download_filename;
+	gboolean user_removed;
+	gboolean in_progress;
+	gboolean in_batch;
+} RegistryPluginInfo;
+
+/* Called as a new generation of the registry is compared to the previous
+ * one. position is the index of an added plugin in the new generation. */
+typedef struct _RegistryDiffFuncs {
+	void (*add)(RegistryPluginInfo *info, guint position, gpointer data);
+	void (*update)(RegistryPluginInfo *info, gboolean changed,
+			gpointer data);
+	void (*remove)(RegistryPluginInfo *info, gpointer data);
+} RegistryDiffFuncs;
+
+RegistryVersion registry_version_parse(const gchar *str);
+gint registry_version_compare(RegistryVersion a, RegistryVersion b);
+
+RegistryPluginInfo *registry_plugin_info_new_from_key_file(
+		GKeyFile *key_file, const gchar *group, RegistryArena *arena);
+RegistryPluginInfo *registry_plugin_info_new_from_cache(
+		RegistryCache *cache, guint record, RegistryArena *arena);
+RegistryPluginInfo *registry_plugin_info_new_from_details(
+		const gchar *file, RegistryPluginInfo *summary);
+gboolean registry_plugin_info_equal(RegistryPluginInfo *a,
+		RegistryPluginInfo *b);
+void registry_plugin_info_adopt(RegistryPluginInfo *info,
+		RegistryPluginInfo *old);
+void registry_plugin_info_free(RegistryPluginInfo *info);
+
+GPtrArray *registry_parse_key_file(const gchar *file, RegistryArena *arena);
+GPtrArray *registry_parse_data(const gchar *data, gsize len,
+		RegistryArena *arena);
+GPtrArray *registry_parse_cache(const gchar *file, const gchar *tag,
+		RegistryArena *arena);
+void registry_plugin_info_compile(RegistryPluginInfo *info,
+		RegistryCacheWriter *writer);
+gint registry_cache_save(GPtrArray *infos, const gchar *file,
+		const gchar *tag);
+
+GHashTable *registry_generation_new(void);
+gboolean registry_generation_add(GHashTable *next, GHashTable *prev,
+		RegistryPluginInfo *info, const RegistryDiffFuncs *funcs,
+		gpointer data);
+void registry_generation_finish(GHashTable *next, GHashTable *prev,
+		gboolean complete, const RegistryDiffFuncs *funcs,
+		gpointer data);
+
+const gchar *registry_plugin_get_checksum(RegistryPluginInfo *info,
+		GChecksumType *type);
+gint registry_plugin_verify(RegistryPluginInfo *info, const gchar *digest);
+gchar *registry_file_checksum(const gchar *file, GChecksumType type);
+gchar *registry_plugin_get_delta_url(RegistryPluginInfo *info,
+		const gchar *from_sum);
+gchar *registry_plugin_get_details_url(RegistryPluginInfo *info,
+		const gchar *base_url);
+gint registry_plugin_patch(const gchar *old_file, const gchar *patch_file,
+		const gchar *new_file, gint64 max_size, GChecksum *checksum);
+gint registry_plugin_install(RegistryPluginInfo *info, const gchar *file,
+		const gchar *dir);
+gint registry_plugin_uninstall(RegistryPluginInfo *info);
+
+#endif /* __REGISTRY_CORE_H__ */
@@ -0,0 +1,229 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Search index of the registry.
+ *
+ * Each entry added is a document numbered in order, whose text is the
+ * case folded name, description, author and license. Every trigram of the
+ * text maps to the ascending list of the documents that contain it. A
+ * query is split into words, and the documents of its rarest trigram are
+ * the candidates, which then must contain every word. Without a word of
+ * three characters, every document is a candidate. The result of the last
+ * search is kept as a byte per document, so it can be tested for each row
+ * of a view. A removed document is only blanked, so once those outnumber
+ * the rest the caller builds a new index.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "registry_index.h"
+
+#define TRIGRAM(p) GUINT_TO_POINTER(((guint)(guchar)(p)[0] << 16) | \
+		((guint)(guchar)(p)[1] << 8) | (guint)(guchar)(p)[2])
+
+struct _RegistryIndex {
+	GHashTable *trigrams;
+	GPtrArray *texts;
+	GByteArray *matches;
+	gchar **words;
+	guint dead;
+};
+
+static gchar *registry_index_fold(const gchar *str, gssize len)
+{
+	if (g_utf8_validate(str, len, NULL))
+		return g_utf8_casefold(str, len);
+	return g_ascii_strdown(str, len);
+}
+
+static gboolean registry_index_match_doc(RegistryIndex *index, guint doc)
+{
+	const gchar *text = g_ptr_array_index(index->texts, doc);
+	gint i;
+
+	if (!text)
+		return FALSE;
+	for (i = 0; index->words[i]; i++)
+		if (!strstr(text, index->words[i]))
+			return FALSE;
+	return TRUE;
+}
+
+static void registry_index_docs_free(gpointer docs)
+{
+	g_array_free(docs, TRUE);
+}
+
+RegistryIndex *registry_index_new(void)
+{
+	RegistryIndex *index = g_new0(RegistryIndex, 1);
+
+	index->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, registry_index_docs_free);
+	index->texts = g_ptr_array_new_with_free_func(g_free);
+	index->matches = g_byte_array_new();
+
+	return index;
+}
+
+/* Add an entry, and get its document number. If a search is active, the
+ * entry is matched against it. */
+guint registry_index_add(RegistryIndex *index, RegistryPluginInfo *info)
+{
+	const gchar *fields[4];
+	GString *str = g_string_new(NULL);
+	GArray *docs;
+	gchar *text, *p;
+	guint doc = index->texts->len;
+	guint8 match;
+	gint i;
+
+	fields[0] = info->name;
+	fields[1] = info->description;
+	fields[2] = info->author;
+	fields[3] = info->license;
+	for (i = 0; i < G_N_ELEMENTS(fields); i++) {
+		if (!fields[i])
+			continue;
+		g_string_append(str, fields[i]);
+		g_string_append_c(str, '\n');
+	}
+	text = registry_index_fold(str->str, str->len);
+	g_string_free(str, TRUE);
+	g_ptr_array_add(index->texts, text);
+
+	/* trigrams don't span fields */
+	for (p = text; p[0] && p[1] && p[2]; p++) {
+		if (p[0] == '\n' || p[1] == '\n' || p[2] == '\n')
+			continue;
+		docs = g_hash_table_lookup(index->trigrams, TRIGRAM(p));
+		if (!docs) {
+			docs = g_array_new(FALSE, FALSE, sizeof(guint));
+			g_hash_table_insert(index->trigrams, TRIGRAM(p), docs);
+		}
+		if (docs->len == 0 ||
+		    g_array_index(docs, guint, docs->len - 1) != doc)
+			g_array_append_val(docs, doc);
+	}
+
+	match = index->words && registry_index_match_doc(index, doc);
+	g_byte_array_append(index->matches, &match, 1);
+
+	return doc;
+}
+
+/* The document stays in the lists of its trigrams, but never matches */
+void registry_index_remove(RegistryIndex *index, guint doc)
+{
+	g_return_if_fail(doc < index->texts->len);
+
+	if (g_ptr_array_index(index->texts, doc))
+		index->dead++;
+	g_free(g_ptr_array_index(index->texts, doc));
+	g_ptr_array_index(index->texts, doc) = NULL;
+	index->matches->data[doc] = 0;
+}
+
+/* Whether removed documents outnumber the others, so that the index is
+ * worth building again from the live entries */
+gboolean registry_index_is_sparse(RegistryIndex *index)
+{
+	return index->dead > index->texts->len - index->dead;
+}
+
+/* Search for the documents containing every word of query, ignoring case.
+ * Returns how many matched, or -1 if the query has no words, in which case
+ * every document matches. */
+gint registry_index_search(RegistryIndex *index, const gchar *query)
+{
+	GArray *docs = NULL, *list;
+	gchar *folded, **words;
+	const gchar *p;
+	guint doc, i, n = 0;
+	gint count = 0;
+
+	g_strfreev(index->words);
+	index->words = NULL;
+
+	folded = registry_index_fold(query, -1);
+	words = g_strsplit_set(folded, " \t\r\n", -1);
+	g_free(folded);
+	for (i = 0; words[i]; i++) {
+		if (*words[i])
+			words[n++] = words[i];
+		else
+			g_free(words[i]);
+	}
+	words[n] = NULL;
+	if (n == 0) {
+		g_free(words);
+		return -1;
+	}
+
+	index->words = words;
+	memset(index->matches->data, 0, index->matches->len);
+
+	for (i = 0; words[i]; i++) {
+		for (p = words[i]; p[0] && p[1] && p[2]; p++) {
+			list = g_hash_table_lookup(index->trigrams, TRIGRAM(p));
+			if (!list)
+				return 0;
+			if (!docs || list->len < docs->len)
+				docs = list;
+		}
+	}
+
+	if (docs) {
+		for (i = 0; i < docs->len; i++) {
+			doc = g_array_index(docs, guint, i);
+			if (registry_index_match_doc(index, doc)) {
+				index->matches->data[doc] = 1;
+				count++;
+			}
+		}
+	} else {
+		for (doc = 0; doc < index->texts->len; doc++) {
+			if (registry_index_match_doc(index, doc)) {
+				index->matches->data[doc] = 1;
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+gboolean registry_index_matches(RegistryIndex *index, guint doc)
+{
+	if (!index->words)
+		return TRUE;
+	return doc < index->matches->len && index->matches->data[doc];
+}
+
+void registry_index_free(RegistryIndex *index)
+{
+	if (!index)
+		return;
+	g_hash_table_destroy(index->trigrams);
+	g_ptr_array_free(index->texts, TRUE);
+	g_byte_array_free(index->matches, TRUE);
+	g_strfreev(index->words);
+	g_free(index);
+}
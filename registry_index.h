@@ -0,0 +1,36 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_INDEX_H__
+#define __REGISTRY_INDEX_H__
+
+#include <glib.h>
+
+#include "registry_core.h"
+
+typedef struct _RegistryIndex RegistryIndex;
+
+RegistryIndex *registry_index_new(void);
+guint registry_index_add(RegistryIndex *index, RegistryPluginInfo *info);
+void registry_index_remove(RegistryIndex *index, guint doc);
+gboolean registry_index_is_sparse(RegistryIndex *index);
+gint registry_index_search(RegistryIndex *index, const gchar *query);
+gboolean registry_index_matches(RegistryIndex *index, guint doc);
+void registry_index_free(RegistryIndex *index);
+
+#endif /* __REGISTRY_INDEX_H__ */
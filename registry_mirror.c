@@ -0,0 +1,195 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Mirrors of the registry, and how they have been responding. Requests go
+ * to the mirror with the lowest expected latency first, counting each
+ * recent failure as a slow response, and ties keep the configured order.
+ * The statistics are kept in a key file between sessions, with a group
+ * for each URL.
+ */
+
+#include <glib.h>
+
+#include "registry_mirror.h"
+
+/* in microseconds */
+static const gint64 unknown_latency = 1000000;
+static const gint64 failure_penalty = 5000000;
+
+/* in milliseconds */
+static const guint min_hedge_delay = 500;
+static const guint max_hedge_delay = 5000;
+
+static struct {
+	GPtrArray *mirrors;
+	gchar *file;
+} mirrors = {0};
+
+static void registry_mirror_free(RegistryMirror *mirror)
+{
+	g_free(mirror->url);
+	g_free(mirror);
+}
+
+static void registry_mirrors_load(void)
+{
+	GKeyFile *key_file = g_key_file_new();
+	RegistryMirror *mirror;
+	guint i;
+
+	if (!g_key_file_load_from_file(key_file, mirrors.file,
+				G_KEY_FILE_NONE, NULL)) {
+		g_key_file_free(key_file);
+		return;
+	}
+
+	for (i = 0; i < mirrors.mirrors->len; i++) {
+		mirror = g_ptr_array_index(mirrors.mirrors, i);
+		if (!g_key_file_has_group(key_file, mirror->url))
+			continue;
+		mirror->latency = MAX(g_key_file_get_int64(key_file,
+					mirror->url, "latency", NULL), 0);
+		mirror->failures = MAX(g_key_file_get_integer(key_file,
+					mirror->url, "failures", NULL), 0);
+	}
+	g_key_file_free(key_file);
+}
+
+/* Set the URLs of the registry, in order of preference, and read their
+ * statistics from file */
+void registry_mirrors_init(const gchar * const *urls, const gchar *file)
+{
+	RegistryMirror *mirror;
+	guint i;
+
+	registry_mirrors_done();
+	mirrors.mirrors = g_ptr_array_new_with_free_func(
+			(GDestroyNotify)registry_mirror_free);
+	mirrors.file = g_strdup(file);
+
+	for (i = 0; urls[i]; i++) {
+		mirror = g_new0(RegistryMirror, 1);
+		mirror->url = g_strdup(urls[i]);
+		mirror->position = i;
+		g_ptr_array_add(mirrors.mirrors, mirror);
+	}
+
+	registry_mirrors_load();
+}
+
+void registry_mirrors_done(void)
+{
+	if (mirrors.mirrors)
+		g_ptr_array_free(mirrors.mirrors, TRUE);
+	mirrors.mirrors = NULL;
+	g_free(mirrors.file);
+	mirrors.file = NULL;
+}
+
+static gint64 registry_mirror_score(const RegistryMirror *mirror)
+{
+	return (mirror->latency ? mirror->latency : unknown_latency) +
+		mirror->failures * failure_penalty;
+}
+
+static gint registry_mirror_compare(gconstpointer a, gconstpointer b)
+{
+	const RegistryMirror *ma = *(RegistryMirror **)a;
+	const RegistryMirror *mb = *(RegistryMirror **)b;
+	gint64 sa = registry_mirror_score(ma), sb = registry_mirror_score(mb);
+
+	if (sa != sb)
+		return sa < sb ? -1 : 1;
+	return ma->position < mb->position ? -1 :
+		ma->position > mb->position ? 1 : 0;
+}
+
+/* Get the mirrors to try, best first. The array is the caller's, and the
+ * mirrors stay valid until registry_mirrors_done. */
+GPtrArray *registry_mirrors_order(void)
+{
+	GPtrArray *order = g_ptr_array_new();
+	guint i;
+
+	if (!mirrors.mirrors)
+		return order;
+	for (i = 0; i < mirrors.mirrors->len; i++)
+		g_ptr_array_add(order, g_ptr_array_index(mirrors.mirrors, i));
+	g_ptr_array_sort(order, registry_mirror_compare);
+
+	return order;
+}
+
+/* Count a response that started after latency microseconds, or a request
+ * given up on after that long */
+void registry_mirror_record(RegistryMirror *mirror, gint64 latency)
+{
+	if (latency <= 0)
+		latency = 1;
+	mirror->latency = mirror->latency ?
+		(mirror->latency * 3 + latency) / 4 : latency;
+	mirror->failures = 0;
+}
+
+void registry_mirror_fail(RegistryMirror *mirror)
+{
+	mirror->failures++;
+}
+
+/* How long to wait for a response from a mirror before also asking the
+ * next one, in milliseconds: twice its usual latency */
+guint registry_mirror_hedge_delay(RegistryMirror *mirror)
+{
+	gint64 delay = (mirror->latency ? mirror->latency : unknown_latency) *
+		2 / 1000;
+
+	return CLAMP(delay, min_hedge_delay, max_hedge_delay);
+}
+
+void registry_mirrors_save(void)
+{
+	GKeyFile *key_file;
+	RegistryMirror *mirror;
+	GError *error = NULL;
+	gchar *data;
+	gsize len;
+	guint i;
+
+	if (!mirrors.mirrors || !mirrors.file)
+		return;
+
+	key_file = g_key_file_new();
+	for (i = 0; i < mirrors.mirrors->len; i++) {
+		mirror = g_ptr_array_index(mirrors.mirrors, i);
+		if (!mirror->latency && !mirror->failures)
+			continue;
+		g_key_file_set_int64(key_file, mirror->url, "latency",
+				mirror->latency);
+		g_key_file_set_integer(key_file, mirror->url, "failures",
+				mirror->failures);
+	}
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+	if (!g_file_set_contents(mirrors.file, data, len, &error)) {
+		g_warning("registry mirrors: %s", error->message);
+		g_error_free(error);
+	}
+	g_free(data);
+	g_key_file_free(key_file);
+}
@@ -0,0 +1,42 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_MIRROR_H__
+#define __REGISTRY_MIRROR_H__
+
+#include <glib.h>
+
+/* A URL of the registry. latency is the smoothed time to the first byte of
+ * a response in microseconds, or 0 if unknown, and failures counts the
+ * failed requests since the last success. */
+typedef struct _RegistryMirror {
+	gchar *url;
+	guint position;
+	gint64 latency;
+	guint failures;
+} RegistryMirror;
+
+void registry_mirrors_init(const gchar * const *urls, const gchar *file);
+void registry_mirrors_done(void);
+GPtrArray *registry_mirrors_order(void);
+void registry_mirror_record(RegistryMirror *mirror, gint64 latency);
+void registry_mirror_fail(RegistryMirror *mirror);
+guint registry_mirror_hedge_delay(RegistryMirror *mirror);
+void registry_mirrors_save(void);
+
+#endif /* __REGISTRY_MIRROR_H__ */
@@ -0,0 +1,336 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parsing of the registry on a worker thread. Pieces of a registry being
+ * downloaded, or a whole registry file, are parsed in the order they are
+ * pushed, and the infos are handed back to the main loop in small batches,
+ * no more of them per iteration than fit in a time budget, so that a large
+ * registry loads without holding up the user interface. What is parsed
+ * from key files is compiled into the registry cache along the way. The
+ * infos of a parser are allocated from its arena, so a generation of the
+ * registry is released in one step.
+ *
+ * The infos are not touched by the worker once they are handed back.
+ */
+
+#include <glib.h>
+
+#include "utils.h"
+#include "registry_core.h"
+#include "registry_parser.h"
+
+#define PARSER_BATCH_SIZE 64
+
+/* how often the main loop checks for batches, in ms, and how long it
+ * spends on them at a time, in us */
+static const guint poll_interval = 10;
+static const gint64 delivery_budget = 8000;
+
+typedef enum {
+	PARSER_JOB_DATA,
+	PARSER_JOB_FILE,
+	PARSER_JOB_END
+} ParserJobType;
+
+typedef struct _ParserJob {
+	ParserJobType type;
+	gchar *data;
+	gsize len;
+} ParserJob;
+
+struct _RegistryParser {
+	GThread *thread;
+	GAsyncQueue *jobs;
+	GAsyncQueue *results;
+	gint cancelled;
+	gint count;
+	gint ref_count;
+
+	/* worker state, read by the main loop after the end */
+	RegistryCacheWriter *writer;
+	RegistryArena *arena;
+	gchar *cache_file;
+	gchar *source_file;
+	gchar *tag;
+	gboolean ok;
+	gint64 parse_time;
+
+	/* main loop state */
+	RegistryParserFunc func;
+	gpointer data;
+	guint poll_id;
+	gboolean ended;
+};
+
+/* pushed to the results after the last batch */
+static gint end_marker;
+
+/* workers of freed parsers, which may still be finishing their input */
+static GSList *parser_threads;
+
+static void parser_job_free(ParserJob *job)
+{
+	g_free(job->data);
+	g_free(job);
+}
+
+static void parser_batch_free(GPtrArray *infos)
+{
+	g_ptr_array_foreach(infos, (GFunc)registry_plugin_info_free, NULL);
+	g_ptr_array_free(infos, TRUE);
+}
+
+/* The parser is held by the main loop and the worker, and freed by
+ * whichever lets go of it last, so that cancelling never waits on the
+ * worker */
+static void parser_unref(RegistryParser *parser)
+{
+	gpointer item;
+
+	if (!g_atomic_int_dec_and_test(&parser->ref_count))
+		return;
+
+	while ((item = g_async_queue_try_pop(parser->jobs)))
+		parser_job_free(item);
+	while ((item = g_async_queue_try_pop(parser->results)))
+		if (item != &end_marker)
+			parser_batch_free(item);
+	g_async_queue_unref(parser->jobs);
+	g_async_queue_unref(parser->results);
+
+	if (parser->writer)
+		registry_cache_writer_free(parser->writer);
+	registry_arena_unref(parser->arena);
+	g_free(parser->cache_file);
+	g_free(parser->source_file);
+	g_free(parser->tag);
+	g_free(parser);
+}
+
+/* hand the infos to the main loop, a batch at a time. takes the infos. */
+static void parser_emit(RegistryParser *parser, GPtrArray *infos,
+		gboolean compile)
+{
+	GPtrArray *batch = NULL;
+	RegistryPluginInfo *info;
+	guint i;
+
+	g_atomic_int_add(&parser->count, infos->len);
+	for (i = 0; i < infos->len; i++) {
+		info = g_ptr_array_index(infos, i);
+		if (compile)
+			registry_plugin_info_compile(info, parser->writer);
+		if (!batch)
+			batch = g_ptr_array_sized_new(PARSER_BATCH_SIZE);
+		g_ptr_array_add(batch, info);
+		if (batch->len == PARSER_BATCH_SIZE) {
+			g_async_queue_push(parser->results, batch);
+			batch = NULL;
+		}
+	}
+	if (batch)
+		g_async_queue_push(parser->results, batch);
+	g_ptr_array_free(infos, TRUE);
+}
+
+static gpointer parser_thread(gpointer data)
+{
+	RegistryParser *parser = data;
+	ParserJob *job;
+	GPtrArray *infos;
+	gboolean compile;
+	gint64 start;
+
+	for (;;) {
+		job = g_async_queue_pop(parser->jobs);
+		if (job->type == PARSER_JOB_END)
+			break;
+		if (g_atomic_int_get(&parser->cancelled)) {
+			parser_job_free(job);
+			continue;
+		}
+
+		start = g_get_monotonic_time();
+		infos = NULL;
+		compile = TRUE;
+		if (job->type == PARSER_JOB_DATA) {
+			infos = registry_parse_data(job->data, job->len,
+					parser->arena);
+		} else if (parser->cache_file &&
+			   registry_cache_is_current(parser->cache_file,
+				   job->data) &&
+			   (infos = registry_parse_cache(parser->cache_file,
+				   parser->tag, parser->arena))) {
+			compile = FALSE;
+		} else {
+			infos = registry_parse_key_file(job->data,
+					parser->arena);
+		}
+		if (infos)
+			parser_emit(parser, infos, compile && parser->writer);
+		else
+			parser->ok = FALSE;
+		parser->parse_time += g_get_monotonic_time() - start;
+		parser_job_free(job);
+	}
+	parser_job_free(job);
+
+	/* what was compiled is only the whole registry if all of it parsed */
+	if (parser->ok && parser->writer &&
+	    registry_cache_writer_get_length(parser->writer) > 0 &&
+	    !g_atomic_int_get(&parser->cancelled)) {
+		start = g_get_monotonic_time();
+		registry_cache_writer_set_source(parser->writer,
+				parser->source_file);
+		registry_cache_writer_write(parser->writer, parser->cache_file);
+		parser->parse_time += g_get_monotonic_time() - start;
+	}
+
+	g_async_queue_push(parser->results, &end_marker);
+	parser_unref(parser);
+
+	return NULL;
+}
+
+/* hand batches to the callback until they run out or the budget does */
+static gboolean parser_poll_cb(gpointer data)
+{
+	RegistryParser *parser = data;
+	gint64 start = g_get_monotonic_time();
+	gpointer result;
+
+	while ((result = g_async_queue_try_pop(parser->results))) {
+		if (result == &end_marker) {
+			parser->poll_id = 0;
+			parser->ended = TRUE;
+			parser->func(NULL, parser->ok, parser->data);
+			return FALSE;
+		}
+		parser->func(result, TRUE, parser->data);
+		if (g_get_monotonic_time() - start >= delivery_budget)
+			break;
+	}
+
+	return TRUE;
+}
+
+/* Start a parser. If cache_file is set, what is parsed from key files is
+ * compiled into it once all of it has parsed, stamped with source_file,
+ * the registry file it stands for, and files are read from it when it is
+ * current. */
+RegistryParser *registry_parser_new(const gchar *cache_file,
+		const gchar *source_file, const gchar *tag,
+		RegistryParserFunc func, gpointer data)
+{
+	RegistryParser *parser = g_new0(RegistryParser, 1);
+
+	parser->jobs = g_async_queue_new();
+	parser->results = g_async_queue_new();
+	parser->ok = TRUE;
+	parser->ref_count = 2;
+	parser->arena = registry_arena_new();
+	parser->func = func;
+	parser->data = data;
+	if (cache_file) {
+		parser->cache_file = g_strdup(cache_file);
+		parser->source_file = g_strdup(source_file);
+		parser->tag = g_strdup(tag);
+		parser->writer = registry_cache_writer_new(tag);
+	}
+
+	parser->thread = g_thread_new("registry-parser", parser_thread,
+			parser);
+	parser->poll_id = g_timeout_add(poll_interval, parser_poll_cb,
+			parser);
+
+	return parser;
+}
+
+/* parse a piece of a registry key file, made of complete sections */
+void registry_parser_push_data(RegistryParser *parser, const gchar *data,
+		gsize len)
+{
+	ParserJob *job = g_new0(ParserJob, 1);
+
+	job->type = PARSER_JOB_DATA;
+	job->data = g_strndup(data, len);
+	job->len = len;
+	g_async_queue_push(parser->jobs, job);
+}
+
+/* parse a registry key file, or the cache compiled from it */
+void registry_parser_push_file(RegistryParser *parser, const gchar *file)
+{
+	ParserJob *job = g_new0(ParserJob, 1);
+
+	job->type = PARSER_JOB_FILE;
+	job->data = g_strdup(file);
+	g_async_queue_push(parser->jobs, job);
+}
+
+/* no more input; the callback is called with NULL infos after the rest */
+void registry_parser_end(RegistryParser *parser)
+{
+	ParserJob *job = g_new0(ParserJob, 1);
+
+	job->type = PARSER_JOB_END;
+	g_async_queue_push(parser->jobs, job);
+}
+
+/* the number of infos parsed so far, handed back or not */
+guint registry_parser_get_count(RegistryParser *parser)
+{
+	return g_atomic_int_get(&parser->count);
+}
+
+/* the time spent parsing and compiling, once the parser is done */
+gint64 registry_parser_get_parse_time(RegistryParser *parser)
+{
+	return parser->ended ? parser->parse_time : 0;
+}
+
+/* Stop the parser, dropping what was not handed back. The worker finishes
+ * the input it is on in the background, without handing it back, and the
+ * parser is freed when it is through. registry_parser_join_all() waits
+ * for it. */
+void registry_parser_free(RegistryParser *parser)
+{
+	if (!parser)
+		return;
+
+	g_atomic_int_set(&parser->cancelled, 1);
+	registry_parser_end(parser);
+	if (parser->poll_id)
+		g_source_remove(parser->poll_id);
+	parser_threads = g_slist_prepend(parser_threads, parser->thread);
+	parser_unref(parser);
+}
+
+/* Wait for the workers of the freed parsers to finish, so that none is
+ * left running the plug-in's code or writing the cache once it is
+ * unloaded */
+void registry_parser_join_all(void)
+{
+	GSList *cur;
+
+	for (cur = parser_threads; cur; cur = cur->next)
+		g_thread_join(cur->data);
+	g_slist_free(parser_threads);
+	parser_threads = NULL;
+}
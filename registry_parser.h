@@ -0,0 +1,44 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_PARSER_H__
+#define __REGISTRY_PARSER_H__
+
+#include <glib.h>
+
+typedef struct _RegistryParser RegistryParser;
+
+/* Called on the main loop with each batch of parsed infos, which it
+ * takes, and then with NULL infos when the parser is done. ok is FALSE if
+ * any of the input failed to parse. The last call may free the parser. */
+typedef void (*RegistryParserFunc)(GPtrArray *infos, gboolean ok,
+		gpointer data);
+
+RegistryParser *registry_parser_new(const gchar *cache_file,
+		const gchar *source_file, const gchar *tag,
+		RegistryParserFunc func, gpointer data);
+void registry_parser_push_data(RegistryParser *parser, const gchar *data,
+		gsize len);
+void registry_parser_push_file(RegistryParser *parser, const gchar *file);
+void registry_parser_end(RegistryParser *parser);
+guint registry_parser_get_count(RegistryParser *parser);
+gint64 registry_parser_get_parse_time(RegistryParser *parser);
+void registry_parser_free(RegistryParser *parser);
+void registry_parser_join_all(void);
+
+#endif /* __REGISTRY_PARSER_H__ */
@@ -0,0 +1,223 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Content-addressed store of verified plug-in binaries, so that installing
+ * a binary again, after removing or updating it, needs no download. Each
+ * file is named by its checksum. Using a file updates its modification
+ * time, and the least recently used files are removed to keep the store
+ * under its size.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "registry_store.h"
+
+typedef struct _StoreEntry {
+	gchar *path;
+	time_t mtime;
+	guint64 size;
+} StoreEntry;
+
+static struct {
+	gchar *dir;
+	guint64 max_size;
+} store = {0};
+
+/* A store of max_size 0 keeps nothing */
+void registry_store_init(const gchar *dir, guint64 max_size)
+{
+	g_free(store.dir);
+	store.dir = g_strdup(dir);
+	store.max_size = max_size;
+
+	if (max_size > 0 && g_mkdir_with_parents(dir, 0700) < 0) {
+		FILE_OP_ERROR(dir, "g_mkdir_with_parents");
+		store.max_size = 0;
+	}
+}
+
+void registry_store_done(void)
+{
+	g_free(store.dir);
+	store.dir = NULL;
+	store.max_size = 0;
+}
+
+/* Get the path of an entry, or NULL if the checksum is not a hex digest */
+static gchar *registry_store_path(const gchar *sum)
+{
+	gchar *name, *path;
+	const gchar *p;
+
+	if (!store.dir || store.max_size == 0 || !sum || !*sum)
+		return NULL;
+	for (p = sum; *p; p++)
+		if (!g_ascii_isxdigit(*p))
+			return NULL;
+
+	name = g_ascii_strdown(sum, -1);
+	path = g_build_filename(store.dir, name, NULL);
+	g_free(name);
+
+	return path;
+}
+
+gboolean registry_store_has(const gchar *sum)
+{
+	gchar *path = registry_store_path(sum);
+	gboolean ret = path && g_file_test(path, G_FILE_TEST_IS_REGULAR);
+
+	g_free(path);
+	return ret;
+}
+
+static gint store_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const StoreEntry *ea = a, *eb = b;
+
+	if (ea->mtime != eb->mtime)
+		return ea->mtime < eb->mtime ? -1 : 1;
+	return 0;
+}
+
+/* Remove the least recently used entries beyond the size of the store */
+static void registry_store_trim(void)
+{
+	GDir *dir;
+	GArray *entries;
+	StoreEntry entry;
+	GStatBuf st;
+	const gchar *name;
+	guint64 total = 0;
+	guint i;
+
+	dir = g_dir_open(store.dir, 0, NULL);
+	if (!dir)
+		return;
+
+	entries = g_array_new(FALSE, FALSE, sizeof(StoreEntry));
+	while ((name = g_dir_read_name(dir))) {
+		entry.path = g_build_filename(store.dir, name, NULL);
+		if (g_stat(entry.path, &st) < 0 || !S_ISREG(st.st_mode)) {
+			g_free(entry.path);
+			continue;
+		}
+		entry.mtime = st.st_mtime;
+		entry.size = st.st_size;
+		total += entry.size;
+		g_array_append_val(entries, entry);
+	}
+	g_dir_close(dir);
+
+	g_array_sort(entries, store_entry_compare);
+	for (i = 0; i < entries->len; i++) {
+		StoreEntry *e = &g_array_index(entries, StoreEntry, i);
+
+		if (total > store.max_size) {
+			debug_print("registry store: evicting %s\n", e->path);
+			if (g_unlink(e->path) == 0)
+				total -= e->size;
+		}
+		g_free(e->path);
+	}
+	g_array_free(entries, TRUE);
+}
+
+/* Keep a copy of a verified file under its checksum */
+gint registry_store_add(const gchar *file, const gchar *sum)
+{
+	gchar *path = registry_store_path(sum);
+	gchar *contents;
+	gsize len;
+	GError *error = NULL;
+	gint ret = 0;
+
+	if (!path)
+		return -1;
+
+	if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+		/* already there; count it as used */
+		g_utime(path, NULL);
+		g_free(path);
+		return 0;
+	}
+
+	if (!g_file_get_contents(file, &contents, &len, &error)) {
+		g_warning("registry store: %s", error->message);
+		g_error_free(error);
+		g_free(path);
+		return -1;
+	}
+	if (len > store.max_size) {
+		ret = -1;
+	} else if (!g_file_set_contents(path, contents, len, &error)) {
+		g_warning("registry store: %s", error->message);
+		g_error_free(error);
+		ret = -1;
+	}
+	g_free(contents);
+	g_free(path);
+
+	if (ret == 0)
+		registry_store_trim();
+
+	return ret;
+}
+
+/* Copy the file with a checksum out of the store, checking that it still
+ * has that checksum. An entry that doesn't is removed. */
+gint registry_store_fetch(const gchar *sum, GChecksumType type,
+		const gchar *dest)
+{
+	gchar *path = registry_store_path(sum);
+	gchar *contents, *digest;
+	gsize len;
+	GError *error = NULL;
+	gint ret = -1;
+
+	if (!path)
+		return -1;
+
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		g_free(path);
+		return -1;
+	}
+
+	digest = g_compute_checksum_for_data(type, (const guchar *)contents,
+			len);
+	if (g_ascii_strcasecmp(digest, sum) != 0) {
+		g_warning("registry store: %s is corrupt", path);
+		g_unlink(path);
+	} else if (!g_file_set_contents(dest, contents, len, &error)) {
+		g_warning("registry store: %s", error->message);
+		g_error_free(error);
+	} else {
+		g_utime(path, NULL);
+		ret = 0;
+	}
+	g_free(digest);
+	g_free(contents);
+	g_free(path);
+
+	return ret;
+}
@@ -0,0 +1,31 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REGISTRY_STORE_H__
+#define __REGISTRY_STORE_H__
+
+#include <glib.h>
+
+void registry_store_init(const gchar *dir, guint64 max_size);
+void registry_store_done(void);
+gboolean registry_store_has(const gchar *sum);
+gint registry_store_add(const gchar *file, const gchar *sum);
+gint registry_store_fetch(const gchar *sum, GChecksumType type,
+		const gchar *dest);
+
+#endif /* __REGISTRY_STORE_H__ */
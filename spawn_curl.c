@@ -40,12 +40,12 @@ void close_child_stdout(gint fd)
 #endif
 }
 
-gint spawn_curl(const gchar *url, GChildWatchFunc func, const gchar *outfile,
-        gpointer data)
+gint spawn_curl(const gchar *url, const gchar **args, GChildWatchFunc func,
+        const gchar *outfile, gpointer data, GPid *child_pid)
 {
-	const gchar *cmdline[11] = {"curl", "--location", "--silent",
-		"--max-time", "10"};
-	gint argc = 5;
+	const gchar *cmdline[32] = {"curl", "--location", "--silent",
+		"--fail"};
+	gint argc = 4;
 	gint child_stdout = 0;
 	GPid pid;
 	GError *error = NULL;
@@ -62,6 +62,8 @@ gint spawn_curl(const gchar *url, GChildWatchFunc func, const gchar *outfile,
 		cmdline[argc++] = "--output";
 		cmdline[argc++] = outfile;
 	}
+	for (; args && *args && argc < G_N_ELEMENTS(cmdline) - 1; args++)
+		cmdline[argc++] = *args;
 	cmdline[argc++] = NULL;
 
 	if (g_spawn_async_with_pipes
@@ -85,6 +87,8 @@ gint spawn_curl(const gchar *url, GChildWatchFunc func, const gchar *outfile,
 	}
 
 	g_child_watch_add(pid, func, data);
+	if (child_pid)
+		*child_pid = pid;
 
 	return child_stdout;
 }
@@ -19,8 +19,8 @@
 #ifndef __SPAWN_CURL_H__
 #define __SPAWN_CURL_H__
 
-gint spawn_curl(const gchar *url, GChildWatchFunc func, const gchar *outfile,
-        gpointer data);
+gint spawn_curl(const gchar *url, const gchar **args, GChildWatchFunc func,
+        const gchar *outfile, gpointer data, GPid *child_pid);
 void close_child_stdout(gint fd);
 
 #endif /* __SPAWN_CURL_H__ */
@@ -0,0 +1,232 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Timings and counters of the phases of the registry, for diagnosing slow
+ * opens. Times are in microseconds of the monotonic clock.
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include "utils.h"
+#include "stats.h"
+
+#define STATS_MAX_TRANSFERS 16
+
+typedef struct _StatsCounter {
+	guint count;
+	gint64 total;
+	gint64 last;
+	gint64 max;
+} StatsCounter;
+
+typedef struct _StatsTransfer {
+	gchar *url;
+	gint status;
+	gint64 connect_time;
+	gint64 duration;
+	guint64 bytes;
+} StatsTransfer;
+
+/* the most recent transfers are at the head */
+static struct {
+	StatsCounter phases[N_STATS_PHASES];
+	guint64 bytes;
+	GQueue transfers;
+} stats = {{{0}}};
+
+static const gchar *phase_names[N_STATS_PHASES] = {
+	"transfer",
+	"parse",
+	"render",
+	"checksum",
+	"load",
+	"install",
+	"patch",
+	"search"
+};
+
+gint64 stats_now(void)
+{
+	return g_get_monotonic_time();
+}
+
+void stats_add(StatsPhase phase, gint64 duration)
+{
+	StatsCounter *counter;
+
+	g_return_if_fail(phase < N_STATS_PHASES);
+
+	counter = &stats.phases[phase];
+	counter->count++;
+	counter->total += duration;
+	counter->last = duration;
+	if (duration > counter->max)
+		counter->max = duration;
+}
+
+/* count the time since start towards a phase */
+void stats_record(StatsPhase phase, gint64 start)
+{
+	stats_add(phase, stats_now() - start);
+}
+
+void stats_add_transfer(const gchar *url, gint status, gint64 connect_time,
+		gint64 duration, guint64 bytes)
+{
+	StatsTransfer *transfer = g_new0(StatsTransfer, 1);
+
+	transfer->url = g_strdup(url);
+	transfer->status = status;
+	transfer->connect_time = connect_time;
+	transfer->duration = duration;
+	transfer->bytes = bytes;
+	g_queue_push_head(&stats.transfers, transfer);
+
+	if (g_queue_get_length(&stats.transfers) > STATS_MAX_TRANSFERS) {
+		transfer = g_queue_pop_tail(&stats.transfers);
+		g_free(transfer->url);
+		g_free(transfer);
+	}
+
+	stats.bytes += bytes;
+	stats_add(STATS_TRANSFER, duration);
+}
+
+gchar *stats_to_string(void)
+{
+	GString *str = g_string_new(NULL);
+	StatsCounter *counter;
+	StatsTransfer *transfer;
+	GList *cur;
+	gint i;
+
+	for (i = 0; i < N_STATS_PHASES; i++) {
+		counter = &stats.phases[i];
+		if (!counter->count)
+			continue;
+		g_string_append_printf(str,
+				_("%s: %u in %.1f ms, last %.1f ms, "
+				  "max %.1f ms\n"),
+				phase_names[i], counter->count,
+				counter->total / 1000.0,
+				counter->last / 1000.0,
+				counter->max / 1000.0);
+	}
+	g_string_append_printf(str, _("received: %" G_GUINT64_FORMAT
+				" bytes\n"), stats.bytes);
+
+	for (cur = stats.transfers.head; cur; cur = cur->next) {
+		transfer = cur->data;
+		g_string_append_printf(str,
+				_("%s: %s, connected in %.1f ms, "
+				  "%" G_GUINT64_FORMAT " bytes in %.1f ms\n"),
+				transfer->url,
+				transfer->status < 0 ? _("failed") : _("ok"),
+				transfer->connect_time / 1000.0,
+				transfer->bytes, transfer->duration / 1000.0);
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static void json_append_string(GString *str, const gchar *s)
+{
+	g_string_append_c(str, '"');
+	for (; s && *s; s++) {
+		if (*s == '"' || *s == '\\')
+			g_string_append_printf(str, "\\%c", *s);
+		else if ((guchar)*s < 0x20)
+			g_string_append_printf(str, "\\u%04x", (guchar)*s);
+		else
+			g_string_append_c(str, *s);
+	}
+	g_string_append_c(str, '"');
+}
+
+gchar *stats_to_json(void)
+{
+	GString *str = g_string_new("{\n  \"phases\": {");
+	StatsCounter *counter;
+	StatsTransfer *transfer;
+	GList *cur;
+	gint i;
+
+	for (i = 0; i < N_STATS_PHASES; i++) {
+		counter = &stats.phases[i];
+		g_string_append_printf(str, "%s\n    \"%s\": {\"count\": %u, "
+				"\"total_us\": %" G_GINT64_FORMAT ", "
+				"\"last_us\": %" G_GINT64_FORMAT ", "
+				"\"max_us\": %" G_GINT64_FORMAT "}",
+				i ? "," : "", phase_names[i], counter->count,
+				counter->total, counter->last, counter->max);
+	}
+	g_string_append_printf(str, "\n  },\n  \"bytes\": %" G_GUINT64_FORMAT
+			",\n  \"transfers\": [", stats.bytes);
+
+	for (cur = stats.transfers.head; cur; cur = cur->next) {
+		transfer = cur->data;
+		g_string_append(str, cur == stats.transfers.head ?
+				"\n    {\"url\": " : ",\n    {\"url\": ");
+		json_append_string(str, transfer->url);
+		g_string_append_printf(str, ", \"status\": %d, "
+				"\"connect_us\": %" G_GINT64_FORMAT ", "
+				"\"duration_us\": %" G_GINT64_FORMAT ", "
+				"\"bytes\": %" G_GUINT64_FORMAT "}",
+				transfer->status, transfer->connect_time,
+				transfer->duration, transfer->bytes);
+	}
+	g_string_append(str, "\n  ]\n}\n");
+
+	return g_string_free(str, FALSE);
+}
+
+/* write the stats to a JSON file, and a summary to the debug log */
+void stats_dump(const gchar *file)
+{
+	StatsCounter *counter;
+	GError *error = NULL;
+	gchar *json;
+	gint i;
+
+	for (i = 0; i < N_STATS_PHASES; i++) {
+		counter = &stats.phases[i];
+		if (counter->count)
+			debug_print("stats: %s %u in %" G_GINT64_FORMAT
+					" us\n", phase_names[i],
+					counter->count, counter->total);
+	}
+
+	json = stats_to_json();
+	if (!g_file_set_contents(file, json, -1, &error)) {
+		g_warning("stats: %s", error->message);
+		g_error_free(error);
+	}
+	g_free(json);
+}
+
+void stats_free(void)
+{
+	StatsTransfer *transfer;
+
+	while ((transfer = g_queue_pop_head(&stats.transfers))) {
+		g_free(transfer->url);
+		g_free(transfer);
+	}
+}
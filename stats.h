@@ -0,0 +1,47 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <glib.h>
+
+typedef enum {
+	STATS_TRANSFER,
+	STATS_PARSE,
+	STATS_RENDER,
+	STATS_CHECKSUM,
+	STATS_LOAD,
+	STATS_INSTALL,
+	STATS_PATCH,
+	STATS_SEARCH,
+	N_STATS_PHASES
+} StatsPhase;
+
+gint64 stats_now(void);
+void stats_add(StatsPhase phase, gint64 duration);
+void stats_record(StatsPhase phase, gint64 start);
+void stats_add_transfer(const gchar *url, gint status, gint64 connect_time,
+		gint64 duration, guint64 bytes);
+
+gchar *stats_to_string(void);
+gchar *stats_to_json(void);
+void stats_dump(const gchar *file);
+void stats_free(void);
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,1472 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HTTP transfers. When built with libcurl, transfers run in-process on a
+ * single curl multi handle whose sockets and timer are driven by GLib
+ * sources, so that connections, DNS lookups and TLS sessions are reused
+ * between requests. Otherwise each transfer spawns the curl binary.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <signal.h>
+
+#ifdef HAVE_LIBCURL
+#  include <curl/curl.h>
+#endif
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+#include "prefs_common.h"
+#include "utils.h"
+#include "transfer.h"
+#include "spawn_curl.h"
+#include "stats.h"
+
+/* in seconds. a transfer fails if it can't connect in time, or if nothing
+ * arrives for the stall time. the connect timeout adapts to each host. */
+static const glong default_connect_timeout = 15;
+static const glong min_connect_timeout = 5;
+static const glong max_connect_timeout = 30;
+static const glong stall_timeout = 20;
+
+/* in bytes per second: a transfer of known size fails if it is slower on
+ * average */
+static const glong min_rate = 1024;
+
+/* in microseconds */
+static const gint64 progress_interval = 250000;
+
+static const guint default_max_active = 4;
+static const guint retry_delay_ms = 1000;
+static const guint max_retry_delay_ms = 60000;
+
+/* transfers waiting for a slot, highest priority first, transfers waiting
+ * to be retried, and running transfers */
+static struct {
+	GQueue queue;
+	guint active;
+	guint max_active;
+	GSList *retrying;
+	GSList *running;
+	GHashTable *connect_times;
+} scheduler = {{0}};
+
+static void transfer_run_queue(void);
+static void transfer_record_connect(Transfer *transfer);
+static gint transfer_compare_priority(gconstpointer a, gconstpointer b,
+		gpointer data);
+
+#ifdef HAVE_LIBCURL
+typedef struct _TransferSocket {
+	GIOChannel *channel;
+	guint watch_id;
+} TransferSocket;
+
+static struct {
+	CURLM *multi;
+	CURLSH *share;
+	guint timer_id;
+	gint running;
+	GSList *transfers;
+} engine = {0};
+
+static void engine_check_info(void);
+#endif
+
+static void transfer_decoder_free(Transfer *transfer)
+{
+	if (!transfer->decoder)
+		return;
+
+	switch (transfer->encoding) {
+	case TRANSFER_ENCODING_GZIP:
+		g_object_unref(transfer->decoder);
+		break;
+#ifdef HAVE_ZSTD
+	case TRANSFER_ENCODING_ZSTD:
+		ZSTD_freeDStream(transfer->decoder);
+		break;
+#endif
+	default:
+		break;
+	}
+	transfer->decoder = NULL;
+}
+
+static void transfer_free(Transfer *transfer)
+{
+	if (transfer->retry_id)
+		g_source_remove(transfer->retry_id);
+	if (transfer->fp) {
+		fclose(transfer->fp);
+		/* the part of a failed start is continued the next time */
+		if (!transfer->resume)
+			g_unlink(transfer->part_file);
+	}
+	if (transfer->pipe_watch_id)
+		g_source_remove(transfer->pipe_watch_id);
+	if (transfer->pipe) {
+		g_io_channel_shutdown(transfer->pipe, FALSE, NULL);
+		g_io_channel_unref(transfer->pipe);
+	}
+#ifdef HAVE_LIBCURL
+	curl_slist_free_all(transfer->header_list);
+#endif
+	transfer_decoder_free(transfer);
+	g_free(transfer->url);
+	g_free(transfer->outfile);
+	g_free(transfer->if_none_match);
+	g_free(transfer->if_modified_since);
+	g_free(transfer->etag);
+	g_free(transfer->last_modified);
+	g_free(transfer->part_file);
+	g_free(transfer->header_file);
+	g_free(transfer->meta_file);
+	g_free(transfer->if_range);
+	if (transfer->checksum)
+		g_checksum_free(transfer->checksum);
+	g_free(transfer);
+}
+
+/* Parse one line of the response headers */
+static void transfer_header_line(Transfer *transfer, const gchar *line,
+		gsize len)
+{
+	gchar *buf, *value;
+
+	buf = g_strndup(line, len);
+	g_strchomp(buf);
+
+	if (!g_ascii_strncasecmp(buf, "HTTP/", 5)) {
+		/* Start of a new response, e.g. after a redirect */
+		value = strchr(buf, ' ');
+		transfer->response_code = value ? strtol(value, NULL, 10) : 0;
+		transfer->content_length = -1;
+		transfer->range_start = -1;
+		g_free(transfer->etag);
+		g_free(transfer->last_modified);
+		transfer->etag = NULL;
+		transfer->last_modified = NULL;
+	} else if ((value = strchr(buf, ':'))) {
+		*value++ = '\0';
+		g_strstrip(value);
+		if (!g_ascii_strcasecmp(buf, "ETag")) {
+			g_free(transfer->etag);
+			transfer->etag = g_strdup(value);
+		} else if (!g_ascii_strcasecmp(buf, "Last-Modified")) {
+			g_free(transfer->last_modified);
+			transfer->last_modified = g_strdup(value);
+		} else if (!g_ascii_strcasecmp(buf, "Content-Length")) {
+			transfer->content_length =
+				g_ascii_strtoll(value, NULL, 10);
+		} else if (!g_ascii_strcasecmp(buf, "Content-Range") &&
+			   !g_ascii_strncasecmp(value, "bytes ", 6)) {
+			transfer->range_start =
+				g_ascii_strtoll(value + 6, NULL, 10);
+		}
+	}
+
+	g_free(buf);
+}
+
+/* Write a piece of the decompressed body to the file and the write func */
+static gboolean transfer_write_decoded(Transfer *transfer, const gchar *buf,
+		gsize len)
+{
+	if (fwrite(buf, 1, len, transfer->fp) != len) {
+		FILE_OP_ERROR(transfer->part_file, "fwrite");
+		transfer->write_error = TRUE;
+		return FALSE;
+	}
+	if (transfer->checksum) {
+		gint64 start = stats_now();
+
+		g_checksum_update(transfer->checksum, (const guchar *)buf, len);
+		transfer->checksum_time += stats_now() - start;
+	}
+	if (transfer->write_func)
+		transfer->write_func(transfer, buf, len, transfer->data);
+
+	return TRUE;
+}
+
+static gint transfer_decoder_new(Transfer *transfer)
+{
+	switch (transfer->encoding) {
+	case TRANSFER_ENCODING_IDENTITY:
+		return 0;
+	case TRANSFER_ENCODING_GZIP:
+		transfer->decoder = g_zlib_decompressor_new(
+				G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+		return 0;
+	case TRANSFER_ENCODING_ZSTD:
+#ifdef HAVE_ZSTD
+		transfer->decoder = ZSTD_createDStream();
+		if (transfer->decoder &&
+		    !ZSTD_isError(ZSTD_initDStream(transfer->decoder)))
+			return 0;
+		transfer_decoder_free(transfer);
+#endif
+		g_warning("transfer: can't decompress zstd for %s",
+				transfer->url);
+		return -1;
+	}
+	return -1;
+}
+
+/* Decompress a piece of the body, or with flush, the end of it */
+static gboolean transfer_decode_gzip(Transfer *transfer, const gchar *buf,
+		gsize len, gboolean flush)
+{
+	gchar out[16384];
+	gsize read, written;
+	GConverterResult res;
+	GError *error = NULL;
+
+	/* anything after the end of the stream is ignored */
+	if (transfer->decoder_done)
+		return TRUE;
+
+	do {
+		res = g_converter_convert(transfer->decoder, buf, len,
+				out, sizeof out,
+				flush ? G_CONVERTER_INPUT_AT_END :
+				G_CONVERTER_NO_FLAGS,
+				&read, &written, &error);
+		if (res == G_CONVERTER_ERROR) {
+			if (!flush && g_error_matches(error, G_IO_ERROR,
+						G_IO_ERROR_PARTIAL_INPUT)) {
+				/* wait for more input */
+				g_error_free(error);
+				return TRUE;
+			}
+			g_warning("transfer: %s: %s", transfer->url,
+					error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		buf += read;
+		len -= read;
+		if (written && !transfer_write_decoded(transfer, out, written))
+			return FALSE;
+		if (res == G_CONVERTER_FINISHED) {
+			transfer->decoder_done = TRUE;
+			return TRUE;
+		}
+	} while (len > 0 || written == sizeof out || (flush && read));
+
+	return !flush;
+}
+
+#ifdef HAVE_ZSTD
+static gboolean transfer_decode_zstd(Transfer *transfer, const gchar *buf,
+		gsize len, gboolean flush)
+{
+	gchar out[16384];
+	ZSTD_inBuffer in = {buf, len, 0};
+	ZSTD_outBuffer output;
+	size_t ret;
+
+	if (flush)
+		return transfer->decoder_done;
+
+	do {
+		output.dst = out;
+		output.size = sizeof out;
+		output.pos = 0;
+		ret = ZSTD_decompressStream(transfer->decoder, &output, &in);
+		if (ZSTD_isError(ret)) {
+			g_warning("transfer: %s: %s", transfer->url,
+					ZSTD_getErrorName(ret));
+			return FALSE;
+		}
+		/* 0 at the end of a frame */
+		transfer->decoder_done = ret == 0;
+		if (output.pos && !transfer_write_decoded(transfer, out,
+					output.pos))
+			return FALSE;
+	} while (in.pos < in.size || output.pos == output.size);
+
+	return TRUE;
+}
+#endif
+
+static gboolean transfer_decode(Transfer *transfer, const gchar *buf,
+		gsize len, gboolean flush)
+{
+	gboolean ok = FALSE;
+
+	switch (transfer->encoding) {
+	case TRANSFER_ENCODING_GZIP:
+		ok = transfer_decode_gzip(transfer, buf, len, flush);
+		break;
+#ifdef HAVE_ZSTD
+	case TRANSFER_ENCODING_ZSTD:
+		ok = transfer_decode_zstd(transfer, buf, len, flush);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if (!ok)
+		transfer->write_error = TRUE;
+	return ok;
+}
+
+/* Report the progress, at most every progress_interval unless done. The
+ * rate is smoothed over the intervals. */
+static void transfer_progress(Transfer *transfer, gboolean done)
+{
+	gint64 now = stats_now();
+	gint64 elapsed = now - transfer->progress_time;
+	guint64 rate;
+
+	if (!done && elapsed < progress_interval)
+		return;
+	if (elapsed > 0) {
+		rate = (transfer->received - transfer->progress_received) *
+			G_USEC_PER_SEC / elapsed;
+		transfer->rate = (transfer->rate + rate) / 2;
+	}
+	transfer->progress_time = now;
+	transfer->progress_received = transfer->received;
+
+	if (transfer->progress_func)
+		transfer->progress_func(transfer, transfer->data);
+}
+
+/* Handle a piece of the response body as received */
+static gboolean transfer_write(Transfer *transfer, const gchar *buf,
+		gsize len)
+{
+	gboolean ok;
+
+	if (transfer->cancelled)
+		return FALSE;
+	transfer->bytes += len;
+	if (transfer->decoder)
+		ok = transfer_decode(transfer, buf, len, FALSE);
+	else
+		ok = transfer_write_decoded(transfer, buf, len);
+
+	/* the engine counts the bytes on the wire itself */
+	if (!transfer->handle) {
+		transfer->received = transfer->resume_offset + transfer->bytes;
+		if (transfer->content_length >= 0)
+			transfer->total = transfer->resume_offset +
+				transfer->content_length;
+	}
+	transfer_progress(transfer, FALSE);
+
+	return ok;
+}
+
+/* Continue a previous attempt from its .part file, if its sidecar says
+ * it is of the same URL and has a validator to make the range request
+ * conditional on */
+static void transfer_resume_prepare(Transfer *transfer)
+{
+	GKeyFile *key_file;
+	GStatBuf st;
+	gchar *url = NULL, *validator = NULL;
+	gint64 length = -1;
+
+	if (!transfer->resume || transfer->encoding ||
+	    transfer->write_func)
+		return;
+
+	key_file = g_key_file_new();
+	if (g_key_file_load_from_file(key_file, transfer->meta_file,
+				G_KEY_FILE_NONE, NULL)) {
+		url = g_key_file_get_string(key_file, "part", "url", NULL);
+		validator = g_key_file_get_string(key_file, "part", "etag",
+				NULL);
+		if (!validator)
+			validator = g_key_file_get_string(key_file, "part",
+					"last_modified", NULL);
+		if (g_key_file_has_key(key_file, "part", "length", NULL))
+			length = g_key_file_get_int64(key_file, "part",
+					"length", NULL);
+	}
+	g_key_file_free(key_file);
+
+	if (url && validator && !strcmp(url, transfer->url) &&
+	    g_stat(transfer->part_file, &st) == 0 && st.st_size > 0 &&
+	    (length < 0 || st.st_size < length)) {
+		debug_print("transfer: resuming %s from %" G_GINT64_FORMAT
+				"\n", transfer->url, (gint64)st.st_size);
+		transfer->resume_offset = st.st_size;
+		transfer->if_range = validator;
+		validator = NULL;
+	} else {
+		g_unlink(transfer->part_file);
+		g_unlink(transfer->meta_file);
+	}
+	g_free(url);
+	g_free(validator);
+}
+
+/* Hash the part of the body kept from the previous attempt */
+static gint transfer_resume_checksum(Transfer *transfer)
+{
+	GMappedFile *map;
+	GError *error = NULL;
+
+	map = g_mapped_file_new(transfer->part_file, FALSE, &error);
+	if (!map) {
+		g_warning("transfer: %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+	g_checksum_reset(transfer->checksum);
+	g_checksum_update(transfer->checksum,
+			(const guchar *)g_mapped_file_get_contents(map),
+			g_mapped_file_get_length(map));
+	g_mapped_file_unref(map);
+
+	return 0;
+}
+
+/* The server sent the whole body rather than the rest of it, because the
+ * resource changed or it doesn't do ranges. Drop the previous part. */
+static gint transfer_resume_restart(Transfer *transfer)
+{
+	gchar *contents;
+	gsize len;
+	GError *error = NULL;
+	gint ret = 0;
+
+	debug_print("transfer: %s was sent whole\n", transfer->url);
+
+	if (!g_file_get_contents(transfer->part_file, &contents, &len,
+				&error)) {
+		g_warning("transfer: %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+	if (len < transfer->resume_offset ||
+	    !g_file_set_contents(transfer->part_file,
+		    contents + transfer->resume_offset,
+		    len - transfer->resume_offset, NULL)) {
+		ret = -1;
+	} else if (transfer->checksum) {
+		g_checksum_reset(transfer->checksum);
+		g_checksum_update(transfer->checksum,
+				(const guchar *)contents +
+				transfer->resume_offset,
+				len - transfer->resume_offset);
+	}
+	g_free(contents);
+	transfer->resume_offset = 0;
+
+	return ret;
+}
+
+/* Keep the .part file of a failed transfer for the next attempt, with the
+ * URL, the validator and the expected length in a sidecar. If the attempt
+ * was sent the whole body, only that is kept, as the validator is its
+ * own; a range that doesn't continue the part is dropped with it. */
+static void transfer_resume_save(Transfer *transfer)
+{
+	GKeyFile *key_file;
+	GStatBuf st;
+	gchar *data;
+	gsize len;
+
+	if (transfer->resume_offset > 0 &&
+	    ((transfer->response_code == 200 &&
+	      transfer_resume_restart(transfer) < 0) ||
+	     (transfer->response_code == 206 &&
+	      transfer->range_start != transfer->resume_offset))) {
+		g_unlink(transfer->part_file);
+		g_unlink(transfer->meta_file);
+		return;
+	}
+
+	if (!transfer->resume || transfer->encoding ||
+	    transfer->write_func ||
+	    (!transfer->etag && !transfer->last_modified) ||
+	    (transfer->response_code != 200 &&
+	     transfer->response_code != 206) ||
+	    g_stat(transfer->part_file, &st) < 0 || st.st_size == 0) {
+		g_unlink(transfer->part_file);
+		g_unlink(transfer->meta_file);
+		return;
+	}
+
+	key_file = g_key_file_new();
+	g_key_file_set_string(key_file, "part", "url", transfer->url);
+	if (transfer->etag)
+		g_key_file_set_string(key_file, "part", "etag",
+				transfer->etag);
+	if (transfer->last_modified)
+		g_key_file_set_string(key_file, "part", "last_modified",
+				transfer->last_modified);
+	if (transfer->content_length >= 0)
+		g_key_file_set_int64(key_file, "part", "length",
+				transfer->content_length +
+				(transfer->response_code == 206 ?
+				 transfer->resume_offset : 0));
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+	if (!g_file_set_contents(transfer->meta_file, data, len, NULL))
+		g_unlink(transfer->part_file);
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
+/* Clear the state of an attempt, before another one */
+static void transfer_reset(Transfer *transfer)
+{
+#ifdef HAVE_LIBCURL
+	curl_slist_free_all(transfer->header_list);
+#endif
+	transfer->header_list = NULL;
+	transfer_decoder_free(transfer);
+	transfer->decoder_done = FALSE;
+	g_free(transfer->etag);
+	g_free(transfer->last_modified);
+	g_free(transfer->header_file);
+	g_free(transfer->if_range);
+	transfer->etag = NULL;
+	transfer->last_modified = NULL;
+	transfer->header_file = NULL;
+	transfer->if_range = NULL;
+	transfer->status = -1;
+	transfer->response_code = 0;
+	transfer->content_length = -1;
+	transfer->resume_offset = 0;
+	transfer->range_start = -1;
+	transfer->child_exited = FALSE;
+	transfer->write_error = FALSE;
+	transfer->start_error = FALSE;
+	transfer->connect_time = 0;
+	transfer->checksum_time = 0;
+	transfer->bytes = 0;
+	transfer->received = 0;
+	transfer->total = -1;
+	transfer->rate = 0;
+	transfer->progress_received = 0;
+	if (transfer->checksum)
+		g_checksum_reset(transfer->checksum);
+}
+
+static gboolean transfer_retry_cb(gpointer data)
+{
+	Transfer *transfer = data;
+
+	transfer->retry_id = 0;
+	scheduler.retrying = g_slist_remove(scheduler.retrying, transfer);
+	g_queue_insert_sorted(&scheduler.queue, transfer,
+			transfer_compare_priority, NULL);
+	transfer_run_queue();
+
+	return FALSE;
+}
+
+/* Try a failed transfer again later, unless the error is final: a local
+ * error starting or writing it, or a client error of the server other
+ * than a timeout, a bad range or too many requests. A body cut off or
+ * stalled partway through has a successful code, and is retried. The
+ * delay doubles with each attempt, with some jitter so that transfers
+ * that failed together are not retried together. */
+static gboolean transfer_retry(Transfer *transfer)
+{
+	glong code = transfer->response_code;
+	guint delay;
+
+	if (transfer->attempt >= transfer->max_retries ||
+	    transfer->write_error || transfer->start_error ||
+	    (code >= 400 && code < 500 && code != 408 && code != 416 &&
+	     code != 429))
+		return FALSE;
+
+	delay = MIN(retry_delay_ms << transfer->attempt, max_retry_delay_ms);
+	delay += g_random_int_range(0, delay / 2 + 1);
+	transfer->attempt++;
+	debug_print("transfer: retrying %s in %u ms (attempt %u of %u)\n",
+			transfer->url, delay, transfer->attempt,
+			transfer->max_retries);
+
+	transfer_reset(transfer);
+	transfer->retry_id = g_timeout_add(delay, transfer_retry_cb,
+			transfer);
+	scheduler.retrying = g_slist_prepend(scheduler.retrying, transfer);
+
+	return TRUE;
+}
+
+static void transfer_finish(Transfer *transfer)
+{
+	scheduler.running = g_slist_remove(scheduler.running, transfer);
+
+	/* a truncated compressed body is an error */
+	if (transfer->decoder && transfer->status == 0 &&
+	    transfer->response_code != 304 && !transfer->write_error &&
+	    !transfer_decode(transfer, NULL, 0, TRUE))
+		g_warning("transfer: %s: truncated body", transfer->url);
+
+	if (transfer->write_error || transfer->cancelled)
+		transfer->status = -1;
+
+	if (transfer->fp) {
+		if (fclose(transfer->fp) == EOF) {
+			FILE_OP_ERROR(transfer->part_file, "fclose");
+			transfer->status = -1;
+		}
+		transfer->fp = NULL;
+	}
+
+	if (transfer->status == 0 && transfer->resume_offset > 0 &&
+	    transfer->response_code == 200 &&
+	    transfer_resume_restart(transfer) < 0)
+		transfer->status = -1;
+
+	/* a range other than the rest of the part can't be joined to it */
+	if (transfer->status == 0 && transfer->resume_offset > 0 &&
+	    transfer->response_code == 206 &&
+	    transfer->range_start != transfer->resume_offset) {
+		g_warning("transfer: %s: unexpected range", transfer->url);
+		transfer->status = -1;
+	}
+
+	/* Only replace the output file with a complete, new response */
+	if (transfer->status == 0 && transfer->response_code != 304) {
+		if (rename_force(transfer->part_file, transfer->outfile) < 0) {
+			FILE_OP_ERROR(transfer->outfile, "rename");
+			transfer->status = -1;
+		}
+		g_unlink(transfer->meta_file);
+	} else if (transfer->status < 0 && !transfer->cancelled) {
+		transfer_resume_save(transfer);
+	} else {
+		g_unlink(transfer->part_file);
+		g_unlink(transfer->meta_file);
+	}
+
+	debug_print("transfer: %s finished with status %d (HTTP %ld)\n",
+			transfer->url, transfer->status,
+			transfer->response_code);
+
+	transfer_record_connect(transfer);
+	if (transfer->start_time && !transfer->cancelled)
+		stats_add_transfer(transfer->url, transfer->status,
+				transfer->connect_time,
+				stats_now() - transfer->start_time,
+				transfer->bytes);
+	if (transfer->checksum)
+		stats_add(STATS_CHECKSUM, transfer->checksum_time);
+
+	if (transfer->status < 0 && !transfer->cancelled &&
+	    transfer_retry(transfer)) {
+		if (scheduler.active > 0)
+			scheduler.active--;
+		transfer_run_queue();
+		return;
+	}
+
+	transfer_progress(transfer, TRUE);
+	if (transfer->func)
+		transfer->func(transfer, transfer->data);
+	transfer_free(transfer);
+
+	if (scheduler.active > 0)
+		scheduler.active--;
+	transfer_run_queue();
+}
+
+/* Fallback: run the curl binary */
+
+static void transfer_read_header_file(Transfer *transfer)
+{
+	gchar *contents, *line, *next;
+
+	if (!g_file_get_contents(transfer->header_file, &contents, NULL, NULL))
+		return;
+
+	for (line = contents; *line; line = next) {
+		next = strchr(line, '\n');
+		next = next ? next + 1 : line + strlen(line);
+		transfer_header_line(transfer, line, next - line);
+	}
+
+	g_free(contents);
+	g_unlink(transfer->header_file);
+}
+
+/* The transfer is done when curl has exited and its output is read */
+static void transfer_child_cb(GPid pid, gint status, gpointer data)
+{
+	Transfer *transfer = data;
+	GError *error = NULL;
+
+	if (g_spawn_check_exit_status(status, &error)) {
+		transfer->status = 0;
+	} else {
+		debug_print("transfer: curl: %s\n", error->message);
+		g_error_free(error);
+		transfer->status = -1;
+	}
+	g_spawn_close_pid(pid);
+	transfer->pid = 0;
+	transfer->child_exited = TRUE;
+
+	if (!transfer->pipe) {
+		transfer_read_header_file(transfer);
+		transfer_finish(transfer);
+	}
+}
+
+static gboolean transfer_pipe_cb(GIOChannel *channel, GIOCondition cond,
+		gpointer data)
+{
+	Transfer *transfer = data;
+	gchar buf[8192];
+	gsize len = 0;
+	GIOStatus status;
+
+	status = g_io_channel_read_chars(channel, buf, sizeof buf, &len, NULL);
+	if (len > 0 && !transfer->write_error)
+		transfer_write(transfer, buf, len);
+
+	if (status == G_IO_STATUS_NORMAL || status == G_IO_STATUS_AGAIN)
+		return TRUE;
+
+	/* end of output */
+	transfer->pipe_watch_id = 0;
+	g_io_channel_shutdown(channel, FALSE, NULL);
+	g_io_channel_unref(channel);
+	transfer->pipe = NULL;
+
+	if (transfer->child_exited) {
+		transfer_read_header_file(transfer);
+		transfer_finish(transfer);
+	}
+
+	return FALSE;
+}
+
+static gint transfer_spawn(Transfer *transfer)
+{
+	GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
+	gint ret;
+
+	transfer->header_file = g_strconcat(transfer->outfile, ".hdr", NULL);
+	g_ptr_array_add(args, g_strdup("--connect-timeout"));
+	g_ptr_array_add(args, g_strdup_printf("%ld",
+				transfer->connect_timeout));
+	g_ptr_array_add(args, g_strdup("--speed-limit"));
+	g_ptr_array_add(args, g_strdup("1"));
+	g_ptr_array_add(args, g_strdup("--speed-time"));
+	g_ptr_array_add(args, g_strdup_printf("%ld", stall_timeout));
+	if (transfer->max_time > 0) {
+		g_ptr_array_add(args, g_strdup("--max-time"));
+		g_ptr_array_add(args, g_strdup_printf("%ld",
+					transfer->max_time));
+	}
+	if (transfer->resume_offset > 0) {
+		/* a range of a compressed transport isn't a range of the
+		 * file */
+		g_ptr_array_add(args, g_strdup("--range"));
+		g_ptr_array_add(args, g_strdup_printf("%" G_GINT64_FORMAT "-",
+					transfer->resume_offset));
+		g_ptr_array_add(args, g_strdup("--header"));
+		g_ptr_array_add(args, g_strconcat("If-Range: ",
+					transfer->if_range, NULL));
+	} else if (transfer->encoding == TRANSFER_ENCODING_IDENTITY) {
+		/* a compressed file is decoded here, so it must arrive as it
+		 * is, even if the server labels it as a content encoding */
+		g_ptr_array_add(args, g_strdup("--compressed"));
+	}
+	g_ptr_array_add(args, g_strdup("--dump-header"));
+	g_ptr_array_add(args, g_strdup(transfer->header_file));
+	if (transfer->if_none_match) {
+		g_ptr_array_add(args, g_strdup("--header"));
+		g_ptr_array_add(args, g_strconcat("If-None-Match: ",
+					transfer->if_none_match, NULL));
+	}
+	if (transfer->if_modified_since) {
+		g_ptr_array_add(args, g_strdup("--header"));
+		g_ptr_array_add(args, g_strconcat("If-Modified-Since: ",
+					transfer->if_modified_since, NULL));
+	}
+	g_ptr_array_add(args, NULL);
+
+	/* read the body from curl's stdout */
+	ret = spawn_curl(transfer->url, (const gchar **)args->pdata,
+			transfer_child_cb, NULL, transfer, &transfer->pid);
+	g_ptr_array_free(args, TRUE);
+	if (ret < 0)
+		return -1;
+	/* the connection is made by the child, so count the spawn */
+	transfer->connect_time = stats_now() - transfer->start_time;
+
+#ifdef G_OS_WIN32
+	transfer->pipe = g_io_channel_win32_new_fd(ret);
+#else
+	transfer->pipe = g_io_channel_unix_new(ret);
+#endif
+	g_io_channel_set_encoding(transfer->pipe, NULL, NULL);
+	g_io_channel_set_buffered(transfer->pipe, FALSE);
+	transfer->pipe_watch_id = g_io_add_watch(transfer->pipe,
+			G_IO_IN | G_IO_HUP | G_IO_ERR, transfer_pipe_cb,
+			transfer);
+
+	return 0;
+}
+
+#ifdef HAVE_LIBCURL
+
+/* In-process engine: libcurl multi interface on the GLib main loop */
+
+static gboolean engine_timeout_cb(gpointer data)
+{
+	engine.timer_id = 0;
+	curl_multi_socket_action(engine.multi, CURL_SOCKET_TIMEOUT, 0,
+			&engine.running);
+	engine_check_info();
+	return FALSE;
+}
+
+static int engine_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+	if (engine.timer_id) {
+		g_source_remove(engine.timer_id);
+		engine.timer_id = 0;
+	}
+	if (timeout_ms >= 0)
+		engine.timer_id = g_timeout_add(timeout_ms, engine_timeout_cb,
+				NULL);
+	return 0;
+}
+
+static gboolean engine_io_cb(GIOChannel *channel, GIOCondition cond,
+		gpointer data)
+{
+	curl_socket_t fd = GPOINTER_TO_INT(data);
+	int action = 0;
+
+	if (cond & (G_IO_IN | G_IO_PRI | G_IO_HUP))
+		action |= CURL_CSELECT_IN;
+	if (cond & G_IO_OUT)
+		action |= CURL_CSELECT_OUT;
+	if (cond & (G_IO_ERR | G_IO_NVAL))
+		action |= CURL_CSELECT_ERR;
+
+	curl_multi_socket_action(engine.multi, fd, action, &engine.running);
+	engine_check_info();
+
+	/* The watch is removed in engine_socket_cb when curl is done with
+	 * the socket */
+	return TRUE;
+}
+
+static void engine_socket_free(TransferSocket *sock)
+{
+	if (sock->watch_id)
+		g_source_remove(sock->watch_id);
+	g_io_channel_unref(sock->channel);
+	g_free(sock);
+}
+
+static int engine_socket_cb(CURL *easy, curl_socket_t fd, int what,
+		void *userp, void *socketp)
+{
+	TransferSocket *sock = socketp;
+	GIOCondition cond = 0;
+
+	if (what == CURL_POLL_REMOVE) {
+		if (sock)
+			engine_socket_free(sock);
+		curl_multi_assign(engine.multi, fd, NULL);
+		return 0;
+	}
+
+	if (!sock) {
+		sock = g_new0(TransferSocket, 1);
+#ifdef G_OS_WIN32
+		sock->channel = g_io_channel_win32_new_socket(fd);
+#else
+		sock->channel = g_io_channel_unix_new(fd);
+#endif
+		curl_multi_assign(engine.multi, fd, sock);
+	} else if (sock->watch_id) {
+		g_source_remove(sock->watch_id);
+	}
+
+	if (what & CURL_POLL_IN)
+		cond |= G_IO_IN | G_IO_PRI;
+	if (what & CURL_POLL_OUT)
+		cond |= G_IO_OUT;
+	cond |= G_IO_ERR | G_IO_HUP;
+
+	sock->watch_id = g_io_add_watch(sock->channel, cond, engine_io_cb,
+			GINT_TO_POINTER(fd));
+
+	return 0;
+}
+
+static size_t engine_write_cb(char *buf, size_t size, size_t nmemb,
+		void *userdata)
+{
+	return transfer_write(userdata, buf, size * nmemb) ? size * nmemb : 0;
+}
+
+static size_t engine_header_cb(char *buf, size_t size, size_t nitems,
+		void *userdata)
+{
+	transfer_header_line(userdata, buf, size * nitems);
+	return size * nitems;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+/* called at least once a second, so the rate falls while nothing arrives,
+ * and a cancelled transfer is aborted */
+static int engine_progress_cb(void *userdata, curl_off_t dltotal,
+		curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	Transfer *transfer = userdata;
+
+	if (transfer->cancelled)
+		return 1;
+
+	transfer->received = transfer->resume_offset + dlnow;
+	transfer->total = dltotal > 0 ? transfer->resume_offset + dltotal : -1;
+	transfer_progress(transfer, FALSE);
+
+	return 0;
+}
+#endif
+
+static void engine_check_info(void)
+{
+	CURLMsg *msg;
+	int pending;
+	double connect_time;
+
+	while ((msg = curl_multi_info_read(engine.multi, &pending))) {
+		CURL *easy = msg->easy_handle;
+		Transfer *transfer = NULL;
+
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&transfer);
+		curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE,
+				&transfer->response_code);
+		if (curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME,
+					&connect_time) == CURLE_OK)
+			transfer->connect_time = (gint64)(connect_time * 1e6);
+		if (msg->data.result != CURLE_OK) {
+			debug_print("transfer: %s: %s\n", transfer->url,
+					curl_easy_strerror(msg->data.result));
+			transfer->status = -1;
+		} else {
+			transfer->status = 0;
+		}
+
+		curl_multi_remove_handle(engine.multi, easy);
+		curl_easy_cleanup(easy);
+		transfer->handle = NULL;
+		engine.transfers = g_slist_remove(engine.transfers, transfer);
+
+		transfer_finish(transfer);
+	}
+}
+
+static gint engine_init(void)
+{
+	if (engine.multi)
+		return 0;
+
+	if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		g_warning("curl_global_init failed");
+		return -1;
+	}
+
+	engine.multi = curl_multi_init();
+	if (!engine.multi) {
+		g_warning("curl_multi_init failed");
+		curl_global_cleanup();
+		return -1;
+	}
+	curl_multi_setopt(engine.multi, CURLMOPT_SOCKETFUNCTION,
+			engine_socket_cb);
+	curl_multi_setopt(engine.multi, CURLMOPT_TIMERFUNCTION,
+			engine_timer_cb);
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(engine.multi, CURLMOPT_PIPELINING,
+			CURLPIPE_MULTIPLEX);
+#endif
+
+	/* Share DNS, TLS sessions and connections between easy handles */
+	engine.share = curl_share_init();
+	if (engine.share) {
+		curl_share_setopt(engine.share, CURLSHOPT_SHARE,
+				CURL_LOCK_DATA_DNS);
+		curl_share_setopt(engine.share, CURLSHOPT_SHARE,
+				CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+		curl_share_setopt(engine.share, CURLSHOPT_SHARE,
+				CURL_LOCK_DATA_CONNECT);
+#endif
+	}
+
+	return 0;
+}
+
+static void engine_done(void)
+{
+	GSList *cur;
+
+	if (!engine.multi)
+		return;
+
+	/* Drop unfinished transfers without calling back into the UI */
+	for (cur = engine.transfers; cur; cur = cur->next) {
+		Transfer *transfer = cur->data;
+		curl_multi_remove_handle(engine.multi, transfer->handle);
+		curl_easy_cleanup(transfer->handle);
+		transfer_free(transfer);
+	}
+	g_slist_free(engine.transfers);
+	engine.transfers = NULL;
+
+	if (engine.timer_id) {
+		g_source_remove(engine.timer_id);
+		engine.timer_id = 0;
+	}
+	curl_multi_cleanup(engine.multi);
+	engine.multi = NULL;
+	if (engine.share) {
+		curl_share_cleanup(engine.share);
+		engine.share = NULL;
+	}
+	curl_global_cleanup();
+}
+
+static gint transfer_engine_start(Transfer *transfer)
+{
+	CURL *easy;
+
+	easy = curl_easy_init();
+	if (!easy)
+		return -1;
+
+	curl_easy_setopt(easy, CURLOPT_URL, transfer->url);
+	curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer);
+	curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, engine_write_cb);
+	curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer);
+	curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, engine_header_cb);
+	curl_easy_setopt(easy, CURLOPT_HEADERDATA, transfer);
+	curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072000
+	curl_easy_setopt(easy, CURLOPT_XFERINFOFUNCTION, engine_progress_cb);
+	curl_easy_setopt(easy, CURLOPT_XFERINFODATA, transfer);
+	curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 0L);
+#endif
+	curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT,
+			transfer->connect_timeout);
+	curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, stall_timeout);
+	curl_easy_setopt(easy, CURLOPT_TIMEOUT, transfer->max_time);
+	if (transfer->resume_offset > 0) {
+		/* a range of a compressed transport isn't a range of the
+		 * file. CURLOPT_RESUME_FROM would fail on a whole response to
+		 * If-Range, so ask for the range directly. */
+		gchar *range = g_strdup_printf("%" G_GINT64_FORMAT "-",
+				transfer->resume_offset);
+		gchar *header = g_strconcat("If-Range: ", transfer->if_range,
+				NULL);
+
+		curl_easy_setopt(easy, CURLOPT_RANGE, range);
+		g_free(range);
+		transfer->header_list = curl_slist_append(
+				transfer->header_list, header);
+		g_free(header);
+	} else if (transfer->encoding == TRANSFER_ENCODING_IDENTITY) {
+		/* offer every content encoding that libcurl can decode. a
+		 * compressed file is decoded here, so it must arrive as it
+		 * is, even if the server labels it as a content encoding. */
+#if LIBCURL_VERSION_NUM >= 0x071506
+		curl_easy_setopt(easy, CURLOPT_ACCEPT_ENCODING, "");
+#else
+		curl_easy_setopt(easy, CURLOPT_ENCODING, "");
+#endif
+	}
+	if (engine.share)
+		curl_easy_setopt(easy, CURLOPT_SHARE, engine.share);
+	if (prefs_common.use_http_proxy && prefs_common.http_proxy_host &&
+	    prefs_common.http_proxy_host[0] != '\0')
+		curl_easy_setopt(easy, CURLOPT_PROXY,
+				prefs_common.http_proxy_host);
+
+	if (transfer->if_none_match) {
+		gchar *header = g_strconcat("If-None-Match: ",
+				transfer->if_none_match, NULL);
+		transfer->header_list = curl_slist_append(
+				transfer->header_list, header);
+		g_free(header);
+	}
+	if (transfer->if_modified_since) {
+		gchar *header = g_strconcat("If-Modified-Since: ",
+				transfer->if_modified_since, NULL);
+		transfer->header_list = curl_slist_append(
+				transfer->header_list, header);
+		g_free(header);
+	}
+	curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->header_list);
+
+	if (curl_multi_add_handle(engine.multi, easy) != CURLM_OK) {
+		curl_easy_cleanup(easy);
+		return -1;
+	}
+
+	transfer->handle = easy;
+	engine.transfers = g_slist_prepend(engine.transfers, transfer);
+
+	return 0;
+}
+#endif /* HAVE_LIBCURL */
+
+void transfer_init(void)
+{
+	if (scheduler.max_active == 0)
+		scheduler.max_active = default_max_active;
+#ifdef HAVE_LIBCURL
+	if (engine_init() < 0)
+		g_warning("transfer: falling back to the curl program");
+#endif
+}
+
+void transfer_done(void)
+{
+	Transfer *transfer;
+
+	/* queued transfers are dropped without calling back */
+	while ((transfer = g_queue_pop_head(&scheduler.queue)))
+		transfer_free(transfer);
+	g_slist_free_full(scheduler.retrying, (GDestroyNotify)transfer_free);
+	scheduler.retrying = NULL;
+
+#ifdef HAVE_LIBCURL
+	engine_done();
+#endif
+	g_slist_free(scheduler.running);
+	scheduler.running = NULL;
+	scheduler.active = 0;
+	if (scheduler.connect_times) {
+		g_hash_table_destroy(scheduler.connect_times);
+		scheduler.connect_times = NULL;
+	}
+}
+
+Transfer *transfer_new(const gchar *url, const gchar *outfile)
+{
+	Transfer *transfer;
+
+	g_return_val_if_fail(url != NULL, NULL);
+	g_return_val_if_fail(outfile != NULL, NULL);
+
+	transfer = g_new0(Transfer, 1);
+	transfer->url = g_strdup(url);
+	transfer->outfile = g_strdup(outfile);
+	transfer->part_file = g_strconcat(outfile, ".part", NULL);
+	transfer->meta_file = g_strconcat(outfile, ".part.meta", NULL);
+	transfer->status = -1;
+	transfer->content_length = -1;
+	transfer->range_start = -1;
+	transfer->total = -1;
+
+	return transfer;
+}
+
+/* Get the lowercase host and port of a URL */
+static gchar *transfer_host(const gchar *url)
+{
+	const gchar *host = strstr(url, "://");
+
+	if (!host)
+		return NULL;
+	host += 3;
+	return g_ascii_strdown(host, strcspn(host, "/?#"));
+}
+
+/* Allow a few times the usual connect time of the host, and for a body of
+ * known size, the time to get it at min_rate. Otherwise only a stall ends
+ * the transfer. */
+static void transfer_set_timeouts(Transfer *transfer)
+{
+	gchar *host = transfer_host(transfer->url);
+	gpointer ms = NULL;
+
+	if (host && scheduler.connect_times)
+		ms = g_hash_table_lookup(scheduler.connect_times, host);
+	g_free(host);
+
+	transfer->connect_timeout = ms ?
+		CLAMP(GPOINTER_TO_UINT(ms) * 4 / 1000 + 2,
+				min_connect_timeout, max_connect_timeout) :
+		default_connect_timeout;
+
+	transfer->max_time = 0;
+	if (transfer->expected_size > transfer->resume_offset)
+		transfer->max_time = transfer->connect_timeout + stall_timeout +
+			(transfer->expected_size - transfer->resume_offset) /
+			min_rate;
+}
+
+/* Keep a smoothed connect time of each host. Only the engine measures the
+ * connection itself. */
+static void transfer_record_connect(Transfer *transfer)
+{
+	gchar *host;
+	guint ms, prev;
+
+#ifdef HAVE_LIBCURL
+	if (!engine.multi)
+		return;
+#else
+	return;
+#endif
+	if (transfer->status < 0 || transfer->connect_time <= 0 ||
+	    !(host = transfer_host(transfer->url)))
+		return;
+
+	if (!scheduler.connect_times)
+		scheduler.connect_times = g_hash_table_new_full(g_str_hash,
+				g_str_equal, g_free, NULL);
+	ms = MAX(transfer->connect_time / 1000, 1);
+	prev = GPOINTER_TO_UINT(g_hash_table_lookup(scheduler.connect_times,
+				host));
+	if (prev)
+		ms = (prev * 3 + ms) / 4;
+	g_hash_table_insert(scheduler.connect_times, host,
+			GUINT_TO_POINTER(ms));
+}
+
+/* Open the .part file and hand the transfer to a backend */
+static gint transfer_begin(Transfer *transfer)
+{
+	gint ret;
+
+	debug_print("transfer: getting %s\n", transfer->url);
+
+	transfer->start_time = stats_now();
+	transfer->progress_time = transfer->start_time;
+	if (transfer_decoder_new(transfer) < 0)
+		return -1;
+
+	transfer_resume_prepare(transfer);
+	if (transfer->resume_offset > 0 && transfer->checksum &&
+	    transfer_resume_checksum(transfer) < 0) {
+		transfer->resume_offset = 0;
+		g_free(transfer->if_range);
+		transfer->if_range = NULL;
+	}
+
+	transfer_set_timeouts(transfer);
+
+	transfer->fp = g_fopen(transfer->part_file,
+			transfer->resume_offset > 0 ? "ab" : "wb");
+	if (!transfer->fp) {
+		FILE_OP_ERROR(transfer->part_file, "fopen");
+		return -1;
+	}
+
+#ifdef HAVE_LIBCURL
+	if (engine.multi)
+		ret = transfer_engine_start(transfer);
+	else
+#endif
+		ret = transfer_spawn(transfer);
+
+	if (ret < 0)
+		return -1;
+
+	scheduler.active++;
+	scheduler.running = g_slist_prepend(scheduler.running, transfer);
+	return 0;
+}
+
+static gint transfer_compare_priority(gconstpointer a, gconstpointer b,
+		gpointer data)
+{
+	const Transfer *ta = a, *tb = b;
+
+	/* ties go after, to keep the queue first-in first-out */
+	return ta->priority < tb->priority ? 1 : -1;
+}
+
+/* Start queued transfers while there are free slots. A queued transfer that
+ * fails to start finishes with an error, so its caller is still notified;
+ * the failure is local, so it is not retried. */
+static void transfer_run_queue(void)
+{
+	Transfer *transfer;
+
+	while (scheduler.active < scheduler.max_active &&
+	       (transfer = g_queue_pop_head(&scheduler.queue))) {
+		if (transfer_begin(transfer) < 0) {
+			transfer->status = -1;
+			transfer->start_error = TRUE;
+			scheduler.active++;
+			transfer_finish(transfer);
+		}
+	}
+}
+
+/* Change the priority of a transfer, moving it in the queue if it is
+ * waiting there */
+void transfer_set_priority(Transfer *transfer, gint priority)
+{
+	g_return_if_fail(transfer != NULL);
+
+	if (transfer->priority == priority)
+		return;
+	transfer->priority = priority;
+	if (g_queue_remove(&scheduler.queue, transfer))
+		g_queue_insert_sorted(&scheduler.queue, transfer,
+				transfer_compare_priority, NULL);
+}
+
+/* Limit the number of transfers running at once; 0 restores the default */
+void transfer_set_max_active(guint max_active)
+{
+	scheduler.max_active = max_active > 0 ? max_active : default_max_active;
+	transfer_run_queue();
+}
+
+/* Start downloading to the output file, and call func when done. The body
+ * is written to a .part file which replaces the output file only if the
+ * transfer succeeds with new content, and passed to the write_func as it
+ * arrives. If too many transfers are running, it waits in a queue ordered
+ * by priority. Func is called once, after any retries. The transfer is
+ * freed after func returns, or if it fails to start right away. */
+gint transfer_start(Transfer *transfer, TransferFunc func, gpointer data)
+{
+	g_return_val_if_fail(transfer != NULL, -1);
+
+	transfer->func = func;
+	transfer->data = data;
+
+	if (scheduler.active >= scheduler.max_active) {
+		debug_print("transfer: queueing %s\n", transfer->url);
+		g_queue_insert_sorted(&scheduler.queue, transfer,
+				transfer_compare_priority, NULL);
+		return 0;
+	}
+
+	if (transfer_begin(transfer) < 0) {
+		transfer_free(transfer);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Stop a transfer and drop it without calling its func. It may be called
+ * from the write_func of another transfer, so a running transfer is only
+ * marked: the engine aborts it from its progress callback, and a curl
+ * program is killed. Either way its slot and .part file are released as
+ * it finishes. */
+void transfer_cancel(Transfer *transfer)
+{
+	g_return_if_fail(transfer != NULL);
+
+	debug_print("transfer: cancelling %s\n", transfer->url);
+	transfer->func = NULL;
+	transfer->write_func = NULL;
+	transfer->progress_func = NULL;
+
+	if (g_queue_remove(&scheduler.queue, transfer)) {
+		transfer_free(transfer);
+		return;
+	}
+	if (g_slist_find(scheduler.retrying, transfer)) {
+		scheduler.retrying = g_slist_remove(scheduler.retrying,
+				transfer);
+		transfer_free(transfer);
+		return;
+	}
+
+	transfer->cancelled = TRUE;
+#ifndef G_OS_WIN32
+	if (transfer->pid)
+		kill(transfer->pid, SIGTERM);
+#endif
+}
+
+/* Sum the progress of the running transfers, and get how many there are.
+ * total is -1 if the size of any of them is unknown. */
+guint transfer_get_progress(guint64 *received, gint64 *total, guint64 *rate)
+{
+	Transfer *transfer;
+	GSList *cur;
+	guint count = 0;
+
+	*received = 0;
+	*total = 0;
+	*rate = 0;
+	for (cur = scheduler.running; cur; cur = cur->next) {
+		transfer = cur->data;
+		if (transfer->cancelled)
+			continue;
+		*received += transfer->received;
+		*rate += transfer->rate;
+		if (*total >= 0)
+			*total = transfer->total >= 0 ?
+				*total + transfer->total : -1;
+		count++;
+	}
+
+	return count;
+}
+
+/* Guess the compression of a resource from the extension of its URL */
+TransferEncoding transfer_encoding_from_url(const gchar *url)
+{
+	gsize len = strcspn(url, "?#");
+
+	if (len > 3 && !g_ascii_strncasecmp(url + len - 3, ".gz", 3))
+		return TRANSFER_ENCODING_GZIP;
+	if (len > 4 && !g_ascii_strncasecmp(url + len - 4, ".zst", 4))
+		return TRANSFER_ENCODING_ZSTD;
+	return TRANSFER_ENCODING_IDENTITY;
+}
+
+Transfer *transfer_get(const gchar *url, const gchar *outfile,
+		TransferFunc func, gpointer data)
+{
+	Transfer *transfer = transfer_new(url, outfile);
+
+	if (transfer_start(transfer, func, data) < 0)
+		return NULL;
+
+	return transfer;
+}
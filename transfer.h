@@ -0,0 +1,146 @@
+/*
+ * Sylpheed Plugin Registry Plugin
+ * Copyright (C) 2015 Charles Lehner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+
+#include <glib.h>
+#include <stdio.h>
+
+typedef struct _Transfer Transfer;
+
+typedef enum {
+	TRANSFER_ENCODING_IDENTITY,
+	TRANSFER_ENCODING_GZIP,
+	TRANSFER_ENCODING_ZSTD
+} TransferEncoding;
+
+enum {
+	TRANSFER_PRIORITY_LOW = -10,
+	TRANSFER_PRIORITY_DEFAULT = 0,
+	TRANSFER_PRIORITY_HIGH = 10
+};
+
+typedef void (*TransferFunc)(Transfer *transfer, gpointer data);
+typedef void (*TransferWriteFunc)(Transfer *transfer, const gchar *buf,
+		gsize len, gpointer data);
+
+struct _Transfer {
+	gchar *url;
+	gchar *outfile;
+
+	/* validators for a conditional request */
+	gchar *if_none_match;
+	gchar *if_modified_since;
+
+	/* called with each piece of the body as it arrives */
+	TransferWriteFunc write_func;
+
+	/* compression of the resource itself, as opposed to the transport,
+	 * which is undone before the body is written */
+	TransferEncoding encoding;
+
+	/* if set, updated with the (decompressed) body as it arrives */
+	GChecksum *checksum;
+
+	/* higher priority transfers leave the queue first */
+	gint priority;
+
+	/* keep the .part file of a failed transfer, and continue it with a
+	 * range request the next time. only for transfers without an encoding
+	 * or a write_func. */
+	gboolean resume;
+
+	/* times to try again after a network or server error, waiting longer
+	 * each time */
+	guint max_retries;
+
+	/* if known, about how large the body is, so that a transfer far
+	 * slower than expected fails */
+	gint64 expected_size;
+
+	/* if set, called with the data as the body arrives, at most a few
+	 * times a second, and once more before func */
+	TransferFunc progress_func;
+
+	/* progress on the wire, counting a resumed part: total is -1 if
+	 * unknown, and the rate is in bytes per second */
+	guint64 received;
+	gint64 total;
+	guint64 rate;
+
+	/* result, valid in the TransferFunc */
+	gint status;
+	glong response_code;
+	gint64 content_length;
+	gchar *etag;
+	gchar *last_modified;
+
+	/* timings in microseconds, and bytes of the body received */
+	gint64 start_time;
+	gint64 connect_time;
+	gint64 checksum_time;
+	guint64 bytes;
+
+	TransferFunc func;
+	gpointer data;
+
+	/* backend state */
+	gpointer handle;
+	FILE *fp;
+	gpointer header_list;
+	gpointer decoder;
+	gboolean decoder_done;
+	gchar *part_file;
+	gchar *header_file;
+	GIOChannel *pipe;
+	guint pipe_watch_id;
+	gboolean child_exited;
+	gboolean write_error;
+	gboolean start_error;
+	gint64 resume_offset;
+	gint64 range_start;
+	gchar *if_range;
+	gchar *meta_file;
+	guint attempt;
+	guint retry_id;
+	GPid pid;
+	gboolean cancelled;
+	gint64 progress_time;
+	guint64 progress_received;
+	glong connect_timeout;
+	glong max_time;
+};
+
+#define TRANSFER_NOT_MODIFIED(transfer) \
+	((transfer)->status == 0 && (transfer)->response_code == 304)
+
+void transfer_init(void);
+void transfer_done(void);
+void transfer_set_max_active(guint max_active);
+
+Transfer *transfer_new(const gchar *url, const gchar *outfile);
+TransferEncoding transfer_encoding_from_url(const gchar *url);
+gint transfer_start(Transfer *transfer, TransferFunc func, gpointer data);
+void transfer_set_priority(Transfer *transfer, gint priority);
+void transfer_cancel(Transfer *transfer);
+guint transfer_get_progress(guint64 *received, gint64 *total, guint64 *rate);
+Transfer *transfer_get(const gchar *url, const gchar *outfile,
+		TransferFunc func, gpointer data);
+
+#endif /* __TRANSFER_H__ */